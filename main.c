@@ -2,22 +2,39 @@
  * License: WTFPL
  * Copyleft 2019 DusteD
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
 #include <getopt.h>
+#include <time.h>
+#if defined(__SSE__) || defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <signal.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_net.h>
 #include "64.h"
 
 #define MAX_STRING_SIZE 4096
 #define UDP_PAYLOAD_SIZE 768
-#define SAMPLE_SIZE 192*4
+#define SAMPLE_SIZE (192*4)
 #define IP_ADDR_SIZE 64
 #define DEFAULT_LISTEN_PORT 11000
 #define DEFAULT_LISTENAUDIO_PORT 11001
+#define DEFAULT_LISTENDEBUG_PORT 11002
 #define DEFAULT_WIDTH 384
 #define DEFAULT_HEIGHT 272
 #define TCP_BUFFER_SIZE 1024
@@ -28,9 +45,114 @@
 #define USER_COLORS 16*6 + 15 // 16 6 byte values + the 15 commas between them
 #define PIXMAP_SIZE 0x100
 #define COMMAND_DELAY 10
+#define TELNET_ROWS 40
+#define TELNET_COLS 100
+#define TELNET_MAX_PARAMS 8
+#define TELNET_MAX_KEYS 128
+#define TELNET_TIMEOUT 3000
+#define TELNET_ATTR_REVERSE 0x100
+#define TELNET_KEY_F5 "\x1b[15~"
+#define TELNET_KEY_DOWN "\x1b[B"
+#define TELNET_KEY_UP "\x1b[A"
+#define TELNET_KEY_ENTER "\r\0"
 #define AUDIO_FREQUENCY 48000
 #define AUDIO_CHANNELS 2
 #define AUDIO_SAMPLES 192
+#define AUDIO_FRAME_SIZE (AUDIO_CHANNELS * sizeof(int16_t))
+#define U64_AUDIO_FREQUENCY 47983
+#define DEFAULT_AUDIO_LATENCY 40
+#define AUDIO_STATS_INTERVAL 10000
+#define JITTER_MAX_FRAMES 1024
+#define RS_TAPS 32 // Must be a multiple of 8
+#define RS_PHASES 256
+#define RS_HIST (RS_TAPS * 2 + AUDIO_SAMPLES)
+#define RS_KAISER_BETA 8.0
+#define RS_ROLLOFF 0.9
+#define RS_BENCH_SECONDS 10
+#define RS_BENCH_COMPARE_STEP 7
+#define RS_MIN_SNR 60
+#define RS_MIN_RATE 8000
+#define RS_MAX_RATE 192000 // At most 4 outputs per input, so a block always fits in JITTER_MAX_FRAMES
+#define AUDIO_RING_FRAMES 16384 // Must be a power of two
+#define PACKED_FRAME_SIZE (DEFAULT_WIDTH / 2 * DEFAULT_HEIGHT)
+#define NTSC_LINES 240
+#define PAL_FRAME_PERIOD (19656.0 / 985248.0)
+#define NTSC_FRAME_PERIOD (17095.0 / 1022727.0)
+#define CLOCK_RISE 0.001
+#define AV_QUEUE_FRAMES 16
+#define AV_MAX_DELAY 0.25
+#define AV_DELAY_AVERAGE 0.05
+#define AV_STATS_INTERVAL 1000
+#define HEADLESS_STATS_INTERVAL 10000
+#define REC_VIDEO_BUFFERS 64
+#define REC_AUDIO_BUFFERS 1024
+#define REC_QUEUE_SIZE 2048 // Must be a power of two and hold all buffers
+#define REC_WRITEBACK_SIZE (8 * 1024 * 1024)
+#define REC_PREALLOC_SIZE (256 * 1024 * 1024)
+#define REC_LATENCY_STEPS 4 // Histogram buckets per doubling of the write time
+#define REC_LATENCY_BUCKETS (REC_LATENCY_STEPS * 24) // Up to 16 s in microseconds
+#define PIPE_DEFAULT_FRAMES 50
+#define PIPE_MAX_FRAMES 300 // Audio buffers for them have to fit in a recQueue_t
+#define PIPE_AUDIO_PER_FRAME 6
+#define Y4M_FRAME_HEADER "FRAME\n"
+#define SHOT_DEFAULT_BURST 50
+#define SHOT_MAX_BURST 1500 // Has to fit in a recQueue_t
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 32
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define NATIVE_MAGIC "U64REC\0\0"
+#define NATIVE_VERSION 3 // 1 had only raw frames, 2 no repeats
+#define NATIVE_KEYFRAME_INTERVAL 50
+#define CODEC_RUN_BASE 256
+#define CODEC_SYMBOLS (CODEC_RUN_BASE + 16) // Runs are at most a whole frame, under 2^16
+#define CODEC_MAX_BITS 12
+#define CODEC_TABLE_SIZE (1 << CODEC_MAX_BITS)
+#define CODEC_HEADER_SIZE (CODEC_SYMBOLS / 2) // 4 bit code lengths
+#define CODEC_BENCH_FRAMES 3000
+#define NATIVE_PALETTE_SIZE 16
+#define MKV_CLUSTER_FRAMES 50
+#define MKV_MAX_CUES 4096 // When full every other cue is dropped, so the index still covers the whole recording
+#define MKV_TIMESTAMP_SCALE 1000000 // Timestamps are in ms
+#define MKV_HEADER_MAX 1024
+#define MKV_CUE_POINT_SIZE 27 // With the times and positions written as 8 bytes
+#define MKV_SEEK_SIZE 21
+#define MKV_DURATION_SIZE 11
+#define MKV_UNKNOWN_SIZE 0x01ffffffffffffffULL
+#define PLAY_INDEX_MAGIC "U64IDX\0\0"
+#define PLAY_INDEX_VERSION 1
+#define PLAY_MAX_SPEED 16
+#define PLAY_IDLE_WAIT 0.01
+#define PLAY_READAHEAD_FRAMES 50
+#define TRANSCODE_LOOKUP_BITS 6 // Hash table of 64 for the 16 colors of a palette
+#define TRANSCODE_LOOKUP_SIZE (1 << TRANSCODE_LOOKUP_BITS)
+#define TRANSCODE_SLOTS_PER_THREAD 2
+#define TIMESHIFT_JUMP 5.0 // Seconds skipped by page up/down
+#define NATIVE_MAX_REPEAT 50 // Longest gap filled in on export, in frames or audio blocks
+#define PLC_MAX_GAP 16
+#define PLC_LATE_WINDOW 64 // Packets this far behind are late, further back is a restarted stream
+#define PLC_XFADE 32
+#define PLC_FADE 0.7f
+#define JITTER_OVERRUN_FACTOR 4
+#define JITTER_AVERAGE 0.01
+#define JITTER_KP 0.0005
+#define JITTER_KI 0.000001
+#define JITTER_MAX_CORRECTION 0.005
+#define DBG_ENTRIES 360
+#define DBG_RECV_BATCH 64
+#define DBG_HEADER_SIZE 64
+#define DBG_MAGIC "U64DBG\0\0"
+#define DBG_VERSION 2
+#define DBG_BLOCK_PACKETS 1024
+#define DBG_MAX_THREADS 64
+#define DBG_RW_BIT (1 << 24)
+#define DBG_REORDER_WINDOW 64 // Packets this far behind are late, not a restarted stream
+#define DEFAULT_DBG_CAPTURE_MIB 1024
+#define PKT_MAGIC "U64PKT\0\0"
+#define PKT_VERSION 1
+#define PKT_ALIGN(n) (((n) + 7) & ~7)
+#define LOADER_MAX_FILE_SIZE 0xffffff // RUN_IMG takes a 24 bit length
 
 // "Ok ok, use them then..."
 #define SOCKET_CMD_DMA         0xFF01
@@ -76,6 +198,88 @@ typedef struct __attribute__((__packed__)) {
 	int16_t sample[SAMPLE_SIZE];
 } a64msg_t;
 
+// One debug stream entry per bus cycle: address in bit 0-15, data in bit 16-23, R/W# in bit 24, then
+// NMI#, ROM#, IRQ#, BA, EXROM#, GAME# and PHI2 in bit 25-31
+typedef struct __attribute__((__packed__)) {
+	uint16_t seq;
+	uint16_t reserved;
+	uint32_t entry[DBG_ENTRIES];
+} d64msg_t;
+
+// Capture file header, followed by the received d64msg_t packets back to back
+typedef struct __attribute__((__packed__)) {
+	char magic[8];
+	uint32_t version;
+	uint32_t packetSize;
+	uint64_t packets;
+	uint64_t lostPackets;
+	uint64_t indexOffset;
+	uint32_t blockCount;
+	uint32_t blockPackets;
+	uint8_t reserved[DBG_HEADER_SIZE - 48];
+} dbgHeader_t;
+
+// The index at indexOffset has one of these per DBG_BLOCK_PACKETS packets, with a bit for every address
+// accessed and written in the block. Cycles count from the first captured cycle, including lost packets.
+typedef struct {
+	uint64_t firstCycle;
+	uint64_t lastCycle;
+	uint64_t access[0x10000 / 64];
+	uint64_t write[0x10000 / 64];
+} dbgBlock_t;
+
+typedef struct {
+	char type;
+	int lo;
+	int hi;
+	uint64_t fromCycle;
+	uint64_t toCycle;
+} dbgQuery_t;
+
+typedef struct {
+	uint64_t cycle;
+	uint32_t entry;
+} dbgMatch_t;
+
+typedef struct {
+	uint8_t *map;
+	uint64_t packets;
+	dbgBlock_t *blocks;
+	uint16_t *endSeq;
+	const uint32_t *candidates;
+	const dbgQuery_t *query;
+	uint32_t first;
+	uint32_t last;
+	dbgMatch_t *matches;
+	uint64_t numMatches;
+	uint64_t maxMatches;
+} dbgWork_t;
+
+// Packet capture file: this header, then one record per datagram, each padded to 8 bytes
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved0;
+	uint64_t frequency; // Ticks per second of the record times
+	uint64_t records;
+	uint64_t used; // Bytes, including this header
+	uint8_t reserved[24];
+} pktHeader_t;
+
+typedef enum {
+	PKT_VIDEO,
+	PKT_AUDIO
+} pktKind;
+
+typedef struct {
+	uint64_t time; // Ticks since the capture started
+	uint32_t host;
+	uint16_t len;
+	uint8_t kind;
+	uint8_t reserved;
+	uint8_t payload[];
+} pktRecord_t;
+
 typedef enum {
 	SCOLORS,
 	DCOLORS,
@@ -87,9 +291,496 @@ typedef enum {
 	CMD_START_STREAM,
 	CMD_STOP_STREAM,
 	CMD_RESET,
+	CMD_START_DEBUGSTREAM,
+	CMD_STOP_DEBUGSTREAM,
 	NUM_OF_COMMANDS
 } command;
 
+typedef enum {
+	TELNET_STATE_TEXT,
+	TELNET_STATE_ESC,
+	TELNET_STATE_CSI,
+	TELNET_STATE_IAC,
+	TELNET_STATE_OPTION,
+	TELNET_STATE_SB,
+	TELNET_STATE_SB_IAC
+} telnetState;
+
+// What the Ultimate64 menu looks like, as far as we can tell from its ANSI output
+typedef struct {
+	TCPsocket sock;
+	SDLNet_SocketSet set;
+	telnetState state;
+	int param[TELNET_MAX_PARAMS];
+	int numParams;
+	int x;
+	int y;
+	uint16_t curAttr;
+	uint8_t screen[TELNET_ROWS][TELNET_COLS];
+	uint16_t attr[TELNET_ROWS][TELNET_COLS];
+	uint32_t version;
+	uint32_t sentVersion;
+	int verbose;
+} telnetSession_t;
+
+// Wait for expect (or just for the menu to be drawn, if NULL), then select the entry, or send keys if select is NULL.
+// keys are also the fallback if it can't be told which entry is highlighted.
+typedef struct {
+	const char *expect;
+	const char *select;
+	const uint8_t *keys;
+	int len;
+} telnetStep_t;
+
+typedef void (*rsDot)(const float *l, const float *r, const float *c0, const float *c1, float f, float *out);
+
+// Polyphase resampler state, history is kept deinterleaved as float so the kernels can run straight over it
+typedef struct {
+	float *coeffs;
+	float hist[AUDIO_CHANNELS][RS_HIST];
+	int avail;
+	double pos;
+	double cutoff;
+	rsDot dot;
+	const char *kernelName;
+} resampler_t;
+
+typedef struct {
+	int targetFrames;
+	double avgFrames;
+	double integral;
+	double correction;
+	double step;
+	uint64_t overruns;
+	resampler_t rs;
+	int16_t out[JITTER_MAX_FRAMES * AUDIO_CHANNELS];
+} jitterBuffer_t;
+
+// Single producer (network) single consumer (audio callback) ring, positions only ever grow and wrap at 2^32
+typedef struct {
+	int16_t buf[AUDIO_RING_FRAMES * AUDIO_CHANNELS];
+	SDL_atomic_t readPos;
+	SDL_atomic_t writePos;
+	SDL_atomic_t primed;
+	SDL_atomic_t starved;
+	SDL_atomic_t underruns;
+} audioRing_t;
+
+typedef enum {
+	REC_VIDEO,
+	REC_AUDIO
+} recKind;
+
+typedef struct {
+	recKind kind;
+	uint8_t *data;
+	uint64_t *pixMap;
+	uint64_t seq;
+	double time;
+	uint32_t take; // Counts up each time recording is started
+} recBuf_t;
+
+// Native recording, .u64: this header followed by chunks in the order they were received, all little endian
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint16_t width;
+	uint16_t height;
+	double framePeriod;
+	uint32_t audioRate;
+	uint32_t audioBlockSize;
+	uint64_t frames;
+	uint64_t audioBlocks;
+	uint8_t reserved[16];
+} nativeHeader_t;
+
+typedef enum {
+	NATIVE_PALETTE = 1, // 16 RGBA8888 colors, each a uint32_t 0xRRGGBBAA, written whenever they change
+	NATIVE_VIDEO, // Packed 4bpp frame, low nibble first, seq is the frame number
+	NATIVE_AUDIO, // One block of 16 bit stereo PCM, seq is the block number
+	NATIVE_VIDEO_KEY, // Coded frame that doesn't need the one before, start here when seeking
+	NATIVE_VIDEO_DELTA, // Coded frame on top of the one before
+	NATIVE_VIDEO_REPEAT // Same as the frame before, no payload
+} nativeChunkType;
+
+// Time is seconds on the stream clock, when the frame started or the first sample of the block
+typedef struct {
+	uint32_t type;
+	uint32_t size;
+	uint64_t seq;
+	double time;
+} nativeChunk_t;
+
+// Single producer single consumer queue of buffer pointers
+typedef struct {
+	recBuf_t *buf[REC_QUEUE_SIZE];
+	SDL_atomic_t readPos;
+	SDL_atomic_t writePos;
+} recQueue_t;
+
+typedef struct {
+	uint8_t *out;
+	size_t pos;
+	size_t size;
+	uint64_t acc;
+	int bits;
+} bitWriter_t;
+
+typedef struct {
+	uint8_t *prev;
+	uint32_t *tokens;
+} frameCodec_t;
+
+// State for writing one native recording
+typedef struct {
+	FILE *fp;
+	frameCodec_t codec;
+	uint8_t *coded;
+	uint32_t palette[NATIVE_PALETTE_SIZE];
+	uint64_t frames;
+	uint64_t blocks;
+	uint64_t bytes;
+	uint64_t repeats;
+	int sinceKey;
+} nativeWriter_t;
+
+// BITMAPINFOHEADER, what a VFW track in Matroska carries as its codec private data, followed by the colors
+typedef struct __attribute__((__packed__)) {
+	uint32_t size;
+	int32_t width;
+	int32_t height; // Negative for top down
+	uint16_t planes;
+	uint16_t bitCount;
+	uint32_t compression;
+	uint32_t sizeImage;
+	int32_t xPelsPerMeter;
+	int32_t yPelsPerMeter;
+	uint32_t clrUsed;
+	uint32_t clrImportant;
+	uint8_t colors[NATIVE_PALETTE_SIZE][4]; // Blue, green, red, 0
+} bmpInfoHeader_t;
+
+typedef struct {
+	uint64_t time;
+	uint64_t pos;
+} mkvCue_t;
+
+// State for writing one Matroska recording. Sizes that aren't known yet are written as unknown and filled in when
+// they are, so a recording cut short still plays.
+typedef struct {
+	FILE *fp;
+	int started;
+	double start; // Stream time written as 0
+	off_t segment; // Start of the segment contents, the positions in the index are relative to this
+	off_t cuesSeek; // Void in the seek head that becomes the entry for the index
+	off_t duration; // Void in the info that becomes the duration
+	off_t clusterSize; // Where the size of the open cluster goes, -1 when none is open
+	uint64_t clusterPos;
+	uint64_t clusterTime;
+	int clusterFrames;
+	uint64_t end;
+	uint64_t pixMap[NATIVE_PALETTE_SIZE];
+	mkvCue_t *cues;
+	int cueCount;
+	uint64_t cueCandidates;
+	uint64_t cueStep;
+	uint8_t *frame;
+	uint64_t frames;
+	uint64_t blocks;
+	uint64_t bytes;
+} mkvWriter_t;
+
+typedef struct {
+	uint8_t *p;
+	size_t pos;
+} ebml_t;
+
+// A recording file written back as it goes, see recWriteback()
+typedef struct {
+	FILE *fp;
+	uint64_t started; // Writeback started for everything before this
+	uint64_t dropped; // On disk and out of the page cache before this
+	uint64_t allocated;
+} recOut_t;
+
+// One set of recording files, the next set is opened ahead so switching to it doesn't wait on the disk
+typedef struct {
+	int open;
+	int number;
+	char rawName[MAX_STRING_SIZE + 16];
+	char nativeName[MAX_STRING_SIZE + 16];
+	char mkvName[MAX_STRING_SIZE + 16];
+	FILE *vfp;
+	FILE *afp;
+	FILE *nfp;
+	FILE *mfp;
+	recOut_t out[4];
+	int mkvPart;
+	uint64_t mkvBytes; // In the parts before the current one
+	uint64_t frames;
+	uint64_t blocks;
+	int videoStarted;
+	int audioStarted;
+	double videoStart;
+	double audioStart;
+} recSegment_t;
+
+// Recording is done on its own thread, the receive path takes a free buffer, fills it and queues it for writing
+typedef struct {
+	recBuf_t *bufs;
+	uint8_t *pool;
+	uint32_t *argb;
+	recQueue_t filled;
+	recQueue_t freeVideo;
+	recQueue_t freeAudio;
+	SDL_sem *sem;
+	SDL_Thread *thread;
+	SDL_atomic_t run;
+	SDL_atomic_t backlog;
+	int highWater;
+	int writeError;
+	int writeback;
+	SDL_atomic_t active;
+	uint32_t take;
+	uint32_t segTake;
+	double segSeconds;
+	uint64_t segBytes;
+	int segments;
+	int nextTried;
+	recSegment_t cur;
+	recSegment_t next;
+	uint64_t latency[REC_LATENCY_BUCKETS];
+	uint64_t writes;
+	double maxLatency;
+	nativeWriter_t native;
+	mkvWriter_t mkv;
+	uint64_t droppedFrames;
+	uint64_t droppedBlocks;
+} recorder_t;
+
+typedef void (*yuvExpand)(const uint8_t *packed, const uint8_t *lut, uint8_t *y, uint8_t *u, uint8_t *v, int n);
+
+// Streams video or audio into a pipe on its own thread, so a slow reader never holds up receiving
+typedef struct {
+	recKind kind;
+	const char *name;
+	FILE *fp;
+	int fd; // Already open, for stdout
+	int width;
+	int height;
+	recBuf_t *bufs;
+	uint8_t *pool;
+	uint8_t *out;
+	int count;
+	recQueue_t filled;
+	recQueue_t free;
+	SDL_sem *sem;
+	SDL_sem *space;
+	SDL_Thread *thread;
+	SDL_atomic_t run;
+	SDL_atomic_t failed;
+	SDL_atomic_t opened;
+	double period;
+	int started;
+	double start;
+	uint64_t written;
+	uint64_t dropped;
+	yuvExpand expand;
+	const char *kernelName;
+	uint64_t palette[NATIVE_PALETTE_SIZE];
+	uint8_t lut[3 * NATIVE_PALETTE_SIZE]; // Y, Cb and Cr of each color
+} pipeWriter_t;
+
+// Screenshots are palettized PNGs, encoded on their own thread. A burst takes every frame shown for a while.
+typedef struct {
+	char name[MAX_STRING_SIZE];
+	int count; // Buffers, also the length of a burst
+	int width;
+	int height;
+	recBuf_t *bufs;
+	uint8_t *pool;
+	recQueue_t filled;
+	recQueue_t free;
+	SDL_sem *sem;
+	SDL_Thread *thread;
+	SDL_atomic_t run;
+	SDL_atomic_t busy; // Taken and not saved yet
+	int pending; // Frames still to take
+	int number; // Of the next file
+	int burstFirst;
+	uint8_t *raw;
+	uint8_t *out;
+	int32_t *head;
+	int32_t *prev;
+	uint32_t crc[256];
+} shots_t;
+
+// Instant replay ring, frames and audio blocks as they were shown and played
+typedef struct {
+	int seconds;
+	int frameSlots;
+	int blockSlots;
+	uint8_t *frames;
+	uint32_t *palettes;
+	uint64_t *frameSeq;
+	double *frameTime;
+	int16_t *blocks;
+	uint64_t *blockSeq;
+	double *blockTime;
+	uint64_t frameCount;
+	uint64_t blockCount;
+	uint64_t skippedFrames;
+	uint64_t skippedBlocks;
+	SDL_Thread *thread;
+	SDL_atomic_t dumping;
+	uint64_t dumpFrameStart;
+	uint64_t dumpFrameEnd;
+	uint64_t dumpBlockStart;
+	uint64_t dumpBlockEnd;
+	SDL_atomic_t dumpFrameDone;
+	SDL_atomic_t dumpBlockDone;
+	char dumpName[64];
+} history_t;
+
+// Index of a .u64 recording, offsets are of the chunk headers except for audio, where it's the samples
+typedef struct {
+	uint64_t offset;
+	uint64_t palette;
+	uint64_t key;
+	double time;
+} playFrame_t;
+
+typedef struct {
+	uint64_t offset;
+	double time;
+} playBlock_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved0;
+	uint64_t sourceSize;
+	uint64_t frames;
+	uint64_t blocks;
+	uint8_t reserved[24];
+} playIndexHeader_t;
+
+typedef struct {
+	int native;
+	uint8_t *map;
+	uint64_t mapSize;
+	uint8_t *pcm;
+	uint64_t pcmSize;
+	uint64_t frameSize;
+	uint64_t frames;
+	uint64_t blocks;
+	playFrame_t *frameIdx;
+	playBlock_t *blockIdx;
+	uint8_t *packed;
+	uint64_t decoded;
+	double framePeriod;
+	double blockPeriod;
+	double audioOffset;
+	double start;
+	double duration;
+	double speed;
+	int paused;
+	int loop;
+	double pos; // Seconds into the recording
+	double posStart;
+	double wallStart;
+	uint64_t nextBlock;
+	uint64_t aheadFrom;
+	uint64_t aheadUntil;
+} player_t;
+
+typedef struct {
+	int active;
+	int paused;
+	uint64_t frame; // Position in the instant replay ring
+	uint64_t block;
+} timeShift_t;
+
+// One keyframe interval of a transcode, coded by a worker and written out in order by the main thread
+typedef struct {
+	uint64_t chunk; // UINT64_MAX until a worker has filled it
+	uint32_t frames;
+	uint8_t *coded;
+	uint32_t size[NATIVE_KEYFRAME_INTERVAL];
+	uint32_t type[NATIVE_KEYFRAME_INTERVAL];
+	uint8_t scheme[NATIVE_KEYFRAME_INTERVAL];
+} transcodeSlot_t;
+
+typedef struct {
+	const uint8_t *map;
+	uint64_t frameSize;
+	int width;
+	int height;
+	uint64_t frames;
+	uint64_t chunks;
+	uint32_t palette[NUM_OF_COLORSCHEMES][NATIVE_PALETTE_SIZE];
+	uint32_t lookupColor[NUM_OF_COLORSCHEMES][TRANSCODE_LOOKUP_SIZE]; // 0 is free, real colors always have alpha set
+	uint8_t lookupIndex[NUM_OF_COLORSCHEMES][TRANSCODE_LOOKUP_SIZE];
+	transcodeSlot_t *slots;
+	int window;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+	uint64_t next;
+	uint64_t written;
+	int failed;
+	uint64_t badFrame;
+	// Where each chunk starts in the output and the palette in effect there, for verifying in parallel
+	const uint8_t *out;
+	uint64_t outSize;
+	uint64_t *chunkOffset;
+	uint8_t *chunkScheme;
+	SDL_atomic_t mismatches;
+} transcoder_t;
+
+typedef struct {
+	transcoder_t *tc;
+	uint64_t first;
+	uint64_t last;
+	uint64_t frames;
+	double busy;
+} transcodeWork_t;
+
+// Packet loss concealment
+typedef struct {
+	int started;
+	uint16_t lastSeq;
+	int concealed;
+	uint64_t totalConcealed;
+	uint64_t late;
+	int16_t last[AUDIO_SAMPLES * AUDIO_CHANNELS];
+	int16_t out[AUDIO_SAMPLES * AUDIO_CHANNELS];
+} plc_t;
+
+typedef struct {
+	int started;
+	double offset;
+	double period;
+	double lastUpdate;
+} clockTrack_t;
+
+// Stream clock, both streams are mapped onto it from their arrival times, and video is held back to match the audio
+typedef struct {
+	clockTrack_t audio;
+	clockTrack_t video;
+	uint64_t audioBlocks;
+	uint64_t videoUnit;
+	uint64_t shownUnit;
+	const uint8_t *shownFrame;
+	uint16_t lastFrame;
+	double delay;
+	double offset;
+	uint8_t *frames;
+	double due[AV_QUEUE_FRAMES];
+	uint64_t unit[AV_QUEUE_FRAMES];
+	int head;
+	int queued;
+} streamClock_t;
+
 typedef struct {
 	int scale;
 	int fullscreenFlag;
@@ -98,10 +789,24 @@ typedef struct {
 	int verbose;
 	int fast;
 	int audioFlag;
+	int headless;
 	colorScheme curColors;
-	FILE *vfp;
-	FILE *afp;
 	char fnbuf[MAX_STRING_SIZE];
+	char recName[MAX_STRING_SIZE];
+	char nativeName[MAX_STRING_SIZE];
+	char mkvName[MAX_STRING_SIZE];
+	int recordPaused;
+	char pipeVideoName[MAX_STRING_SIZE];
+	char pipeAudioName[MAX_STRING_SIZE];
+	int pipeStdout;
+	int pipeBlock;
+	int pipeFrames;
+	pipeWriter_t pipeVideo;
+	pipeWriter_t pipeAudio;
+	shots_t shots;
+	char exportName[MAX_STRING_SIZE];
+	char codecBenchName[MAX_STRING_SIZE];
+	char transcodeName[MAX_STRING_SIZE];
 	char hostName[MAX_STRING_SIZE];
 	int stopStreamOnExit;
 	int startStreamOnStart;
@@ -116,6 +821,20 @@ typedef struct {
 	SDL_AudioSpec want;
 	SDL_AudioSpec have;
 	SDL_AudioDeviceID dev;
+	int audioLatency;
+	int audioSamples;
+	int audioFrequency;
+	int benchResampler;
+	jitterBuffer_t jb;
+	audioRing_t ring;
+	plc_t plc;
+	streamClock_t clock;
+	recorder_t rec;
+	history_t history;
+	timeShift_t timeShift;
+	char playName[MAX_STRING_SIZE];
+	player_t play;
+	uint8_t *packed;
 	SDL_Window *win;
 	int width;
 	int height;
@@ -131,6 +850,36 @@ typedef struct {
 	const uint64_t *green;
 	const uint64_t *blue;
 	char ipStr[IP_ADDR_SIZE];
+	char loadFile[MAX_STRING_SIZE];
+	SDL_Thread *loaderThread;
+	SDL_atomic_t loaderBusy;
+	char dbgFile[MAX_STRING_SIZE];
+	uint64_t dbgCaptureSize;
+	int dbgFd;
+	uint8_t *dbgMap;
+	UDPsocket dbgSock;
+	SDLNet_SocketSet dbgSet;
+	UDPpacket **dbgPkgs;
+	uint8_t *dbgPkgBufs[DBG_RECV_BATCH];
+	SDL_Thread *dbgThread;
+	SDL_atomic_t dbgRun;
+	char dbgQuery[MAX_STRING_SIZE];
+	char pktFile[MAX_STRING_SIZE];
+	int pktFd;
+	uint8_t *pktMap;
+	uint64_t pktUsed;
+	uint64_t pktRecords;
+	uint64_t pktStart;
+	int pktFull;
+	char replayFile[MAX_STRING_SIZE];
+	uint8_t *replayMap;
+	uint64_t replaySize;
+	uint64_t replayEnd;
+	uint64_t replayPos;
+	uint64_t replayStart;
+	double replayScale;
+	uint64_t replaySkipped;
+	int replayDone;
 } programData;
 
 // I found the colors here: https://gist.github.com/funkatron/758033
@@ -160,17 +909,34 @@ void setDefaults(programData *data)
 	data->startStreamOnStart = 1;
 	data->listen = DEFAULT_LISTEN_PORT;
 	data->listenaudio = DEFAULT_LISTENAUDIO_PORT;
+	data->audioLatency = DEFAULT_AUDIO_LATENCY;
+	data->audioSamples = AUDIO_SAMPLES;
+	data->audioFrequency = AUDIO_FREQUENCY;
 	data->width = DEFAULT_WIDTH;
 	data->height = DEFAULT_HEIGHT;
 	data->red = sred;
 	data->green = sgreen;
 	data->blue = sblue;
+	data->dbgCaptureSize = (uint64_t)DEFAULT_DBG_CAPTURE_MIB * 1024 * 1024;
+	data->dbgFd = -1;
+	data->pktFd = -1;
+	data->pipeStdout = -1;
+	data->pipeVideo.fd = -1;
+	data->pipeAudio.fd = -1;
+	data->pipeFrames = PIPE_DEFAULT_FRAMES;
+	data->shots.count = SHOT_DEFAULT_BURST;
+	strcpy(data->shots.name, "u64view");
+}
+
+static inline char* ipToStr(char *buf, uint32_t ip)
+{
+	sprintf(buf, "%02i.%02i.%02i.%02i", (ip & 0x000000ff), (ip & 0x0000ff00)>>8, (ip & 0x00ff0000) >> 16, (ip & 0xff000000) >> 24);
+	return buf;
 }
 
 static inline char* intToIp(programData *data, uint32_t ip)
 {
-	sprintf(data->ipStr, "%02i.%02i.%02i.%02i", (ip & 0x000000ff), (ip & 0x0000ff00)>>8, (ip & 0x00ff0000) >> 16, (ip & 0xff000000) >> 24);
-	return data->ipStr;
+	return ipToStr(data->ipStr, ip);
 }
 
 static inline void setColors(programData *data)
@@ -234,112 +1000,536 @@ static inline void pic(SDL_Texture* tex, int width, int height, int pitch, uint3
 	}
 }
 
-int sendSequence(programData *prgData, const uint8_t *data, int len)
+static inline void telnetPut(telnetSession_t *t, uint8_t c)
 {
-	IPaddress ip;
-	TCPsocket sock;
-	uint8_t buf[TCP_BUFFER_SIZE];
-	SDLNet_SocketSet set;
-	set=SDLNet_AllocSocketSet(1);
-	int result = 0;
+	if(t->x >= 0 && t->x < TELNET_COLS && t->y >= 0 && t->y < TELNET_ROWS) {
+		t->screen[t->y][t->x] = c;
+		t->attr[t->y][t->x] = t->curAttr;
+	}
+	t->x++;
+}
 
-	if(SDLNet_ResolveHost(&ip, prgData->hostName, TELNET_PORT)) {
-		printf("Error resolving '%s' : %s\n", prgData->hostName, SDLNet_GetError());
-		SDLNet_FreeSocketSet(set);
-		return EXIT_FAILURE;
+static void telnetClear(telnetSession_t *t, int fromY, int fromX, int toY, int toX)
+{
+	for(int y=fromY; y <= toY && y < TELNET_ROWS; y++) {
+		for(int x=(y == fromY ? fromX : 0); x <= (y == toY ? toX : TELNET_COLS - 1) && x < TELNET_COLS; x++) {
+			t->screen[y][x] = ' ';
+			t->attr[y][x] = t->curAttr;
+		}
 	}
+}
 
-	sock = SDLNet_TCP_Open(&ip);
-	if(!sock) {
-		printf("Error connecting to '%s' : %s\n", prgData->hostName, SDLNet_GetError());
-		SDLNet_FreeSocketSet(set);
-		return EXIT_FAILURE;
+static void telnetCsi(telnetSession_t *t, uint8_t cmd)
+{
+	int p0 = t->numParams > 0 ? t->param[0] : 0;
+	int p1 = t->numParams > 1 ? t->param[1] : 0;
+
+	switch(cmd) {
+		case 'H':
+		case 'f':
+			t->y = (p0 ? p0 : 1) - 1;
+			t->x = (p1 ? p1 : 1) - 1;
+			break;
+		case 'A':
+			t->y -= p0 ? p0 : 1;
+			break;
+		case 'B':
+			t->y += p0 ? p0 : 1;
+			break;
+		case 'C':
+			t->x += p0 ? p0 : 1;
+			break;
+		case 'D':
+			t->x -= p0 ? p0 : 1;
+			break;
+		case 'J':
+			if(p0 == 0) {
+				telnetClear(t, t->y, t->x, TELNET_ROWS - 1, TELNET_COLS - 1);
+			} else if(p0 == 1) {
+				telnetClear(t, 0, 0, t->y, t->x);
+			} else {
+				telnetClear(t, 0, 0, TELNET_ROWS - 1, TELNET_COLS - 1);
+			}
+			break;
+		case 'K':
+			if(p0 == 0) {
+				telnetClear(t, t->y, t->x, t->y, TELNET_COLS - 1);
+			} else if(p0 == 1) {
+				telnetClear(t, t->y, 0, t->y, t->x);
+			} else {
+				telnetClear(t, t->y, 0, t->y, TELNET_COLS - 1);
+			}
+			break;
+		case 'm':
+			if(t->numParams == 0) {
+				t->curAttr = 0;
+			}
+			for(int i=0; i < t->numParams; i++) {
+				int p = t->param[i];
+				if(p == 0) {
+					t->curAttr = 0;
+				} else if(p == 7) {
+					t->curAttr |= TELNET_ATTR_REVERSE;
+				} else if(p == 27) {
+					t->curAttr &= ~TELNET_ATTR_REVERSE;
+				} else if(p >= 30 && p <= 37) {
+					t->curAttr = (t->curAttr & ~0x0f) | (p - 30 + 1);
+				} else if(p >= 40 && p <= 47) {
+					t->curAttr = (t->curAttr & ~0xf0) | ((p - 40 + 1) << 4);
+				} else if(p >= 90 && p <= 97) {
+					t->curAttr = (t->curAttr & ~0x0f) | (p - 90 + 9);
+				}
+			}
+			break;
 	}
 
-	SDLNet_TCP_AddSocket(set, sock);
+	if(t->x < 0) {
+		t->x = 0;
+	}
+	if(t->y < 0) {
+		t->y = 0;
+	}
+}
 
-	SDL_Delay(COMMAND_DELAY);
+// Feed telnet output into the screen model, telnet negotiation is skipped and only the ANSI the menu uses is handled
+static void telnetParse(telnetSession_t *t, const uint8_t *buf, int len)
+{
 	for(int i=0; i < len; i++) {
-		SDL_Delay(1);
+		uint8_t c = buf[i];
+		switch(t->state) {
+			case TELNET_STATE_IAC:
+				// WILL, WONT, DO and DONT have an option byte, subnegotiation runs until IAC SE
+				t->state = (c >= 251 && c <= 254) ? TELNET_STATE_OPTION : (c == 250) ? TELNET_STATE_SB : TELNET_STATE_TEXT;
+				break;
+			case TELNET_STATE_OPTION:
+				t->state = TELNET_STATE_TEXT;
+				break;
+			case TELNET_STATE_SB:
+				if(c == 0xff) {
+					t->state = TELNET_STATE_SB_IAC;
+				}
+				break;
+			case TELNET_STATE_SB_IAC:
+				t->state = (c == 240) ? TELNET_STATE_TEXT : TELNET_STATE_SB;
+				break;
+			case TELNET_STATE_ESC:
+				if(c == '[') {
+					t->state = TELNET_STATE_CSI;
+					t->numParams = 0;
+					memset(t->param, 0, sizeof(t->param));
+				} else {
+					t->state = TELNET_STATE_TEXT;
+				}
+				break;
+			case TELNET_STATE_CSI:
+				if(isdigit(c)) {
+					if(t->numParams == 0) {
+						t->numParams = 1;
+					}
+					t->param[t->numParams - 1] = t->param[t->numParams - 1] * 10 + (c - '0');
+				} else if(c == ';') {
+					if(t->numParams == 0) {
+						t->numParams = 1;
+					}
+					if(t->numParams < TELNET_MAX_PARAMS) {
+						t->numParams++;
+					}
+				} else if(c >= 0x40 && c <= 0x7e) {
+					telnetCsi(t, c);
+					t->state = TELNET_STATE_TEXT;
+				}
+				break;
+			case TELNET_STATE_TEXT:
+			default:
+				if(c == 0xff) {
+					t->state = TELNET_STATE_IAC;
+				} else if(c == 0x1b) {
+					t->state = TELNET_STATE_ESC;
+				} else if(c == '\r') {
+					t->x = 0;
+				} else if(c == '\n') {
+					t->y++;
+				} else if(c == '\b') {
+					if(t->x > 0) {
+						t->x--;
+					}
+				} else if(c >= 0x20) {
+					telnetPut(t, c);
+				}
+				break;
+		}
+	}
+	t->version++;
+}
 
-		if (unlikely(prgData->verbose)) {
-			printf("sending: %02x\n", data[i]);
+// Find text on the screen, ignoring case. Returns 1 and the position if found.
+static int telnetFind(telnetSession_t *t, const char *text, int *row, int *col)
+{
+	int len = strlen(text);
+
+	for(int y=0; y < TELNET_ROWS; y++) {
+		for(int x=0; x + len <= TELNET_COLS; x++) {
+			int i = 0;
+			while(i < len && tolower(t->screen[y][x + i]) == tolower((uint8_t)text[i])) {
+				i++;
+			}
+			if(i == len) {
+				*row = y;
+				*col = x;
+				return 1;
+			}
 		}
+	}
+	return 0;
+}
 
-		result = SDLNet_TCP_Send(sock, &data[i], sizeof(uint8_t));
-		if(result < sizeof(uint8_t)) {
-			printf("Error sending command data: %s\n", SDLNet_GetError());
-			SDLNet_TCP_Close(sock);
-			SDLNet_FreeSocketSet(set);
+void telnetDump(telnetSession_t *t)
+{
+	for(int y=0; y < TELNET_ROWS; y++) {
+		printf("  |%.*s|\n", TELNET_COLS, t->screen[y]);
+	}
+}
+
+// Receive what is pending, waiting up to timeout ms for the first byte. Returns bytes received or -1.
+static int telnetPump(telnetSession_t *t, int timeout)
+{
+	uint8_t buf[TCP_BUFFER_SIZE];
+	int total = 0;
+
+	while(SDLNet_CheckSockets(t->set, timeout) == 1) {
+		int result = SDLNet_TCP_Recv(t->sock, buf, TCP_BUFFER_SIZE);
+		if(result <= 0) {
+			printf("Error: Telnet connection closed: %s\n", SDLNet_GetError());
+			return -1;
+		}
+		telnetParse(t, buf, result);
+		total += result;
+		timeout = 0;
+	}
+	return total;
+}
+
+// Wait until text is shown (or, with NULL, until anything new was drawn) and the screen has stopped changing
+int telnetWait(telnetSession_t *t, const char *text)
+{
+	int row, col;
+	uint32_t start = SDL_GetTicks();
+
+	while(SDL_GetTicks() - start < TELNET_TIMEOUT) {
+		int result = telnetPump(t, SDLNET_TIMEOUT);
+		if(result < 0) {
 			return EXIT_FAILURE;
 		}
-		// Empty u64 send buffer
-		while( SDLNet_CheckSockets(set, SDLNET_TIMEOUT) == 1 ) {
-			result = SDLNet_TCP_Recv(sock, &buf, TCP_BUFFER_SIZE - 1);
-			buf[result]=0;
-			//puts(buf); // debug, messes up terminal.
+		if(result == 0 && t->version != t->sentVersion && (!text || telnetFind(t, text, &row, &col))) {
+			return EXIT_SUCCESS;
 		}
 	}
 
-	SDLNet_TCP_Close(sock);
-	SDLNet_FreeSocketSet(set);
+	printf("Error: Timed out waiting for '%s' in the Ultimate64 menu.\n", text ? text : "menu");
+	if(t->verbose) {
+		telnetDump(t);
+	}
+	return EXIT_FAILURE;
+}
 
+int telnetSend(telnetSession_t *t, const uint8_t *keys, int len)
+{
+	if(t->verbose) {
+		printf("sending %i bytes\n", len);
+	}
+	t->sentVersion = t->version;
+	if(SDLNet_TCP_Send(t->sock, keys, len) < len) {
+		printf("Error sending command data: %s\n", SDLNet_GetError());
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
 
-int sendCommand(programData *prgData, const uint16_t *data, int len)
+// Move the highlight to the menu entry and press enter. The highlighted entry is the one in the list whose colors
+// differ from all the others, if that can't be told the fallback keys are sent instead.
+int telnetSelect(telnetSession_t *t, const char *entry, const uint8_t *fallback, int fallbackLen)
 {
-	IPaddress ip;
-	TCPsocket sock;
-	uint8_t buf[TCP_BUFFER_SIZE];
-	SDLNet_SocketSet set;
-	set=SDLNet_AllocSocketSet(1);
-	int result = 0;
+	uint8_t keys[TELNET_MAX_KEYS];
+	int len = 0;
+	int row, col, first, last, highlight = -1;
 
-	if(SDLNet_ResolveHost(&ip, prgData->hostName, COMMAND_PORT)) {
-		printf("Error resolving '%s' : %s\n", prgData->hostName, SDLNet_GetError());
-		SDLNet_FreeSocketSet(set);
+	if(!telnetFind(t, entry, &row, &col)) {
+		printf("Error: Didn't find '%s' in the Ultimate64 menu.\n", entry);
 		return EXIT_FAILURE;
 	}
 
-	sock = SDLNet_TCP_Open(&ip);
-	if(!sock) {
-		printf("Error connecting to '%s' : %s\n", prgData->hostName, SDLNet_GetError());
-		SDLNet_FreeSocketSet(set);
-		return EXIT_FAILURE;
+	first = last = row;
+	while(first > 0 && t->screen[first - 1][col] != ' ') {
+		first--;
+	}
+	while(last < TELNET_ROWS - 1 && t->screen[last + 1][col] != ' ') {
+		last++;
 	}
 
-	SDLNet_TCP_AddSocket(set, sock);
-
-	SDL_Delay(COMMAND_DELAY);
-	for(int i=0; i < len; i++) {
-		SDL_Delay(1);
-
-		if (unlikely(prgData->verbose)) {
-			printf("sending: %04x\n", data[i]);
+	for(int y=first; y <= last && last - first >= 2; y++) {
+		int same = 0;
+		for(int o=first; o <= last; o++) {
+			same += (t->attr[o][col] == t->attr[y][col]);
 		}
-
-		result = SDLNet_TCP_Send(sock, &data[i], sizeof(uint16_t));
-		if(result < sizeof(uint16_t)) {
-			printf("Error sending command data: %s\n", SDLNet_GetError());
-			SDLNet_TCP_Close(sock);
-			SDLNet_FreeSocketSet(set);
-			return EXIT_FAILURE;
+		if(same == 1) {
+			highlight = y;
+			break;
 		}
-		// Empty u64 send buffer
-		while( SDLNet_CheckSockets(set, SDLNET_TIMEOUT) == 1 ) {
-			result = SDLNet_TCP_Recv(sock, &buf, TCP_BUFFER_SIZE - 1);
-			buf[result]=0;
-			//puts(buf); // debug, messes up terminal.
+	}
+
+	if(highlight == -1) {
+		if(t->verbose) {
+			printf("Can't tell which menu entry is highlighted, using the default key sequence.\n");
 		}
+		return telnetSend(t, fallback, fallbackLen);
 	}
 
-	SDLNet_TCP_Close(sock);
-	SDLNet_FreeSocketSet(set);
+	for(int i=highlight; i != row && len + 4 < TELNET_MAX_KEYS; i += (row > highlight) ? 1 : -1) {
+		memcpy(keys + len, (row > highlight) ? TELNET_KEY_DOWN : TELNET_KEY_UP, 3);
+		len += 3;
+	}
+	memcpy(keys + len, TELNET_KEY_ENTER, 2);
+	len += 2;
+
+	return telnetSend(t, keys, len);
+}
+
+// Run a menu script on the telnet interface, each step waits for the menu to show what it expects before acting
+int runTelnetScript(programData *prgData, const telnetStep_t *steps, int numSteps)
+{
+	IPaddress ip;
+	telnetSession_t *t;
+	int result = EXIT_FAILURE;
+
+	if(SDLNet_ResolveHost(&ip, prgData->hostName, TELNET_PORT)) {
+		printf("Error resolving '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		return EXIT_FAILURE;
+	}
+
+	t = calloc(1, sizeof(telnetSession_t));
+	if(!t) {
+		return EXIT_FAILURE;
+	}
+	memset(t->screen, ' ', sizeof(t->screen));
+	t->verbose = prgData->verbose;
+	t->set = SDLNet_AllocSocketSet(1);
+
+	t->sock = SDLNet_TCP_Open(&ip);
+	if(!t->sock) {
+		printf("Error connecting to '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		goto clean_up;
+	}
+	SDLNet_TCP_AddSocket(t->set, t->sock);
+
+	for(int i=0; i < numSteps; i++) {
+		if(telnetWait(t, steps[i].expect) != EXIT_SUCCESS) {
+			goto clean_up;
+		}
+		if(steps[i].select) {
+			if(telnetSelect(t, steps[i].select, steps[i].keys, steps[i].len) != EXIT_SUCCESS) {
+				goto clean_up;
+			}
+		} else if(telnetSend(t, steps[i].keys, steps[i].len) != EXIT_SUCCESS) {
+			goto clean_up;
+		}
+	}
+	result = EXIT_SUCCESS;
+
+clean_up:
+	if(t->sock) {
+		SDLNet_TCP_Close(t->sock);
+	}
+	SDLNet_FreeSocketSet(t->set);
+	free(t);
+
+	return result;
+}
+
+int sendCommand(programData *prgData, const uint16_t *data, int len)
+{
+	IPaddress ip;
+	TCPsocket sock;
+	uint8_t buf[TCP_BUFFER_SIZE];
+	SDLNet_SocketSet set;
+	set=SDLNet_AllocSocketSet(1);
+	int result = 0;
+
+	if(SDLNet_ResolveHost(&ip, prgData->hostName, COMMAND_PORT)) {
+		printf("Error resolving '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		SDLNet_FreeSocketSet(set);
+		return EXIT_FAILURE;
+	}
+
+	sock = SDLNet_TCP_Open(&ip);
+	if(!sock) {
+		printf("Error connecting to '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		SDLNet_FreeSocketSet(set);
+		return EXIT_FAILURE;
+	}
+
+	SDLNet_TCP_AddSocket(set, sock);
+
+	SDL_Delay(COMMAND_DELAY);
+	for(int i=0; i < len; i++) {
+		SDL_Delay(1);
+
+		if (unlikely(prgData->verbose)) {
+			printf("sending: %04x\n", data[i]);
+		}
+
+		result = SDLNet_TCP_Send(sock, &data[i], sizeof(uint16_t));
+		if(result < sizeof(uint16_t)) {
+			printf("Error sending command data: %s\n", SDLNet_GetError());
+			SDLNet_TCP_Close(sock);
+			SDLNet_FreeSocketSet(set);
+			return EXIT_FAILURE;
+		}
+		// Empty u64 send buffer
+		while( SDLNet_CheckSockets(set, SDLNET_TIMEOUT) == 1 ) {
+			result = SDLNet_TCP_Recv(sock, &buf, TCP_BUFFER_SIZE - 1);
+			buf[result]=0;
+			//puts(buf); // debug, messes up terminal.
+		}
+	}
+
+	SDLNet_TCP_Close(sock);
+	SDLNet_FreeSocketSet(set);
+
+	return EXIT_SUCCESS;
+}
+
+// Send a whole PRG or disk image to the command port as one write, so the transfer only waits on the TCP window
+int sendFile(programData *prgData, const char *fileName)
+{
+	IPaddress ip;
+	TCPsocket sock;
+	FILE *fp;
+	uint8_t *buf;
+	long fileSize;
+	int hdrSize;
+	uint16_t cmd;
+	int result = 0;
+	const char *ext = strrchr(fileName, '.');
+
+	if(ext && (!SDL_strcasecmp(ext, ".prg"))) {
+		cmd = SOCKET_CMD_DMARUN;
+		hdrSize = 4;
+	} else if(ext && (!SDL_strcasecmp(ext, ".d64") || !SDL_strcasecmp(ext, ".g64") ||
+	                  !SDL_strcasecmp(ext, ".d71") || !SDL_strcasecmp(ext, ".g71") || !SDL_strcasecmp(ext, ".d81"))) {
+		cmd = SOCKET_CMD_RUN_IMG;
+		hdrSize = 5;
+	} else {
+		printf("Don't know how to load '%s', expected a .prg, .d64, .g64, .d71, .g71 or .d81 file.\n", fileName);
+		return EXIT_FAILURE;
+	}
+
+	fp = fopen(fileName, "rb");
+	if(!fp) {
+		printf("Error opening %s for reading.\n", fileName);
+		return EXIT_FAILURE;
+	}
+	fseek(fp, 0, SEEK_END);
+	fileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if(fileSize <= 0 || fileSize > ((cmd == SOCKET_CMD_DMARUN) ? 0xffff : LOADER_MAX_FILE_SIZE)) {
+		printf("Error: %s has an unsupported size (%li bytes).\n", fileName, fileSize);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc(hdrSize + fileSize);
+	if(!buf) {
+		printf("Error: Could not allocate %li bytes for %s.\n", fileSize, fileName);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	// Command and length are little endian, images get a 24 bit length
+	buf[0] = cmd & 0xff;
+	buf[1] = cmd >> 8;
+	buf[2] = fileSize & 0xff;
+	buf[3] = (fileSize >> 8) & 0xff;
+	if(hdrSize == 5) {
+		buf[4] = (fileSize >> 16) & 0xff;
+	}
+
+	if(fread(buf + hdrSize, fileSize, 1, fp) != 1) {
+		printf("Error reading %s.\n", fileName);
+		fclose(fp);
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	fclose(fp);
+
+	if(SDLNet_ResolveHost(&ip, prgData->hostName, COMMAND_PORT)) {
+		printf("Error resolving '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		free(buf);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	sock = SDLNet_TCP_Open(&ip);
+	if(!sock) {
+		printf("Error connecting to '%s' : %s\n", prgData->hostName, SDLNet_GetError());
+		free(buf);
+		return EXIT_FAILURE;
+	}
+
+	result = SDLNet_TCP_Send(sock, buf, hdrSize + fileSize);
+	SDLNet_TCP_Close(sock);
+	free(buf);
+
+	if(result < hdrSize + fileSize) {
+		printf("Error sending %s: %s\n", fileName, SDLNet_GetError());
+		return EXIT_FAILURE;
+	}
+
+	// The U64 doesn't answer and keeps the connection open, so this is connecting and handing the
+	// file to the socket, not delivery. Anything that fits in the send buffer takes next to no time.
+	double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+	printf("Sent %s (%li bytes) to %s, connect and send took %.1f ms.\n", fileName, fileSize, prgData->hostName, ms);
 
 	return EXIT_SUCCESS;
 }
 
+static int loaderThread(void *ptr)
+{
+	programData *data = (programData*)ptr;
+
+	sendFile(data, data->loadFile);
+	SDL_AtomicSet(&data->loaderBusy, 0);
+
+	return 0;
+}
+
+// Load a file in the background, the stream keeps running while it is transferred
+void loadFile(programData *data, const char *fileName)
+{
+	if(!strlen(data->hostName)) {
+		printf("Can only load files when started with -u, -U or -I.\n");
+		return;
+	}
+
+	if(!SDL_AtomicCAS(&data->loaderBusy, 0, 1)) {
+		printf("Still loading %s, ignoring %s.\n", data->loadFile, fileName);
+		return;
+	}
+
+	if(data->loaderThread) {
+		SDL_WaitThread(data->loaderThread, NULL);
+	}
+
+	strncpy(data->loadFile, fileName, MAX_STRING_SIZE - 1);
+	printf("Loading %s on Ultimate64...\n", data->loadFile);
+	data->loaderThread = SDL_CreateThread(loaderThread, "loader", data);
+	if(!data->loaderThread) {
+		printf("Error creating loader thread: %s\n", SDL_GetError());
+		SDL_AtomicSet(&data->loaderBusy, 0);
+	}
+}
+
 int runCommand(programData *prgData, command cmd)
 {
 	int result = 0;
@@ -366,6 +1556,16 @@ int runCommand(programData *prgData, command cmd)
 		0x0000
 	};
 
+	const uint16_t debugStartData[] = {
+		SOCKET_CMD_DEBUGSTREAM_ON,
+		0x0000
+	};
+
+	const uint16_t debugStopData[] = {
+		SOCKET_CMD_DEBUGSTREAM_OFF,
+		0x0000
+	};
+
 	switch(cmd) {
 		case CMD_START_STREAM:
 			infoString = "start stream";
@@ -384,6 +1584,16 @@ int runCommand(programData *prgData, command cmd)
 			cmdData = resetData;
 			size = sizeof(resetData) / sizeof(resetData[0]);
 			break;
+		case CMD_START_DEBUGSTREAM:
+			infoString = "start debug stream";
+			cmdData = debugStartData;
+			size = sizeof(debugStartData) / sizeof(debugStartData[0]);
+			break;
+		case CMD_STOP_DEBUGSTREAM:
+			infoString = "stop debug stream";
+			cmdData = debugStopData;
+			size = sizeof(debugStopData) / sizeof(debugStopData[0]);
+			break;
 		default:
 			return EXIT_FAILURE;
 	}
@@ -402,17 +1612,17 @@ int runCommand(programData *prgData, command cmd)
 int powerOff(programData *prgData)
 {
 	int result;
-	const uint8_t data[] = {
-		0x1b, 0x5b, 0x31, 0x35, 0x7e, // f5
-		0x1b, 0x5b, 0x42, // Arrow down
-		0xd, 0x00, //enter
-		0x1b, 0x5b, 0x42,
-		0x1b, 0x5b, 0x42,
-		0xd, 0x00, //enter
+	const uint8_t f5[] = TELNET_KEY_F5;
+	const uint8_t powerMenu[] = TELNET_KEY_DOWN TELNET_KEY_ENTER;
+	const uint8_t powerOffEntry[] = TELNET_KEY_DOWN TELNET_KEY_DOWN TELNET_KEY_ENTER;
+	const telnetStep_t steps[] = {
+		{ NULL, NULL, f5, sizeof(f5) - 1 },
+		{ "Power", "Power", powerMenu, sizeof(powerMenu) - 1 },
+		{ "Power Off", "Power Off", powerOffEntry, sizeof(powerOffEntry) - 1 },
 	};
 
 	printf("Sending power-off sequence to Ultimate64...\n");
-	result = sendSequence(prgData, data, sizeof(data));
+	result = runTelnetScript(prgData, steps, sizeof(steps) / sizeof(steps[0]));
 	if (result != EXIT_SUCCESS) {
 		return result;
 	}
@@ -422,546 +1632,6379 @@ int powerOff(programData *prgData)
 	return EXIT_SUCCESS;
 }
 
-void printColors(const uint64_t *red, const uint64_t *green, const uint64_t *blue)
+static inline uint8_t *dbgSlot(uint8_t *map, uint64_t n)
 {
-	for(int i=0; i < 16; i++) {
-		printf("%02x%02x%02x%c", (int)red[i], (int)green[i],(int)blue[i], ((i==15)?' ':',') );
+	return map + DBG_HEADER_SIZE + n * sizeof(d64msg_t);
+}
+
+// Packets the timeline moves from lastSeq to seq: gap+1, or 0 for a late packet (sets *late) or a restarted stream
+static inline uint32_t dbgSeqStep(uint16_t lastSeq, uint16_t seq, int *late)
+{
+	uint16_t gap = seq - lastSeq - 1;
+
+	*late = 0;
+	if(likely(gap == 0)) {
+		return 1;
+	}
+	if((uint16_t)(lastSeq - seq) < DBG_REORDER_WINDOW) {
+		// Reordered or duplicated, its place in the sequence has already gone by
+		*late = 1;
+		return 0;
+	}
+	if(gap >= 0x8000) {
+		// Further back than that is a restarted stream, not loss
+		return 0;
+	}
+	return (uint32_t)gap + 1;
+}
+
+// Drains the debug stream in batches, received straight into the memory mapped capture file
+static int debugCaptureThread(void *ptr)
+{
+	programData *data = (programData*)ptr;
+	uint64_t maxPackets = (data->dbgCaptureSize - DBG_HEADER_SIZE) / sizeof(d64msg_t);
+	uint64_t packets = 0;
+	uint64_t lost = 0;
+	uint64_t lastReport = 0;
+	uint64_t start = 0;
+	uint64_t now = 0;
+	uint16_t lastSeq = 0;
+	dbgHeader_t *hdr = (dbgHeader_t*)data->dbgMap;
+
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+	while(SDL_AtomicGet(&data->dbgRun)) {
+		if(SDLNet_CheckSockets(data->dbgSet, SDLNET_STREAM_TIMEOUT) < 1) {
+			continue;
+		}
+
+		int batch = DBG_RECV_BATCH;
+		if(unlikely(maxPackets - packets < batch)) {
+			batch = maxPackets - packets;
+		}
+		if(unlikely(batch == 0)) {
+			printf("Debug capture file %s is full, stopping capture.\n", data->dbgFile);
+			break;
+		}
+
+		for(int i=0; i < batch; i++) {
+			data->dbgPkgs[i]->data = dbgSlot(data->dbgMap, packets + i);
+			data->dbgPkgs[i]->maxlen = sizeof(d64msg_t);
+		}
+		data->dbgPkgs[batch] = NULL;
+
+		int r = SDLNet_UDP_RecvV(data->dbgSock, data->dbgPkgs);
+		if(unlikely(r == -1)) {
+			printf("SDLNet_UDP_RecvV error: %s\n", SDLNet_GetError());
+			break;
+		}
+
+		for(int i=0; i < r; i++) {
+			if(unlikely(data->dbgPkgs[i]->len != sizeof(d64msg_t))) {
+				continue;
+			}
+			d64msg_t *d = (d64msg_t*)data->dbgPkgs[i]->data;
+			int late = 0;
+			if(unlikely(packets == 0)) {
+				// Not intToIp(), its buffer belongs to the main loop
+				char ip[IP_ADDR_SIZE];
+				printf("Got data on debug port (%i) from %s:%i\n", DEFAULT_LISTENDEBUG_PORT,
+					ipToStr(ip, data->dbgPkgs[i]->address.host), data->dbgPkgs[i]->address.port);
+				start = SDL_GetPerformanceCounter();
+			} else if(unlikely((uint16_t)(lastSeq+1) != d->seq)) {
+				uint32_t step = dbgSeqStep(lastSeq, d->seq, &late);
+				if(step) {
+					lost += step - 1;
+				}
+			}
+			if(likely(!late)) {
+				lastSeq = d->seq;
+			}
+
+			// Compact away any packets of the wrong size
+			if(unlikely((uint8_t*)d != dbgSlot(data->dbgMap, packets))) {
+				memmove(dbgSlot(data->dbgMap, packets), d, sizeof(d64msg_t));
+			}
+			packets++;
+		}
+		// The map is shared with the file, so a killed capture still says how much of it is filled
+		hdr->packets = packets;
+		hdr->lostPackets = lost;
+
+		now = SDL_GetPerformanceCounter();
+		if(unlikely(data->verbose && packets && now - lastReport > SDL_GetPerformanceFrequency())) {
+			lastReport = now;
+			double sec = (double)(now - start) / SDL_GetPerformanceFrequency();
+			printf("Debug capture: %"PRIu64" packets, %.1f MB/s, %"PRIu64" lost.\n", packets,
+				(packets * sizeof(d64msg_t)) / sec / 1e6, lost);
+		}
 	}
 
+	hdr->packets = packets;
+	hdr->lostPackets = lost;
+
+	if(packets) {
+		double sec = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		printf("Debug capture: %"PRIu64" packets (%"PRIu64" bytes) in %.1f s, %.1f MB/s sustained, %"PRIu64" lost (%.3f%%).\n",
+			packets, packets * sizeof(d64msg_t), sec, (packets * sizeof(d64msg_t)) / sec / 1e6, lost,
+			100.0 * lost / (packets + lost));
+	}
+
+	return 0;
 }
 
-void printHelp(void)
+static inline int bitmapAnyInRange(const uint64_t *bm, int lo, int hi)
 {
-	printf("\nUsage: u64view [-l N] [-a N] [-z N |-f] [-s] [-v] [-V] [-c] [-m] [-t] [-T [RGB,...]] [-u IP | -U IP -I IP] [-o FN]\n"
-			"       -l N  (default 11000) Video port number.\n"
-			"       -a N  (default 11001) Audio port number.\n"
-			"       -z N  (default 1)     Scale the window to N times size, N must be an integer.\n"
-			"       -f    (default off)   Fullscreen, will stretch.\n"
-			"       -s    (default off)   Prefer software rendering, more cpu intensive.\n"
-			"       -v    (default off)   Use vsync.\n"
-			"       -V    (default off)   Verbose output, tell when packets are dropped, how much data was transferred.\n"
-			"       -c    (default off)   Use more versatile drawing method, more cpu intensive, can't scale.\n"
-			"       -m    (default off)   Completely turn off audio.\n"
-			"       -t    (default off)   Use colors that look more like DusteDs TV instead of the 'real' colors.\n"
-			"       -T [] (default off)   No argument: Show color values and help for -T\n"
-			"       -u IP (default off)   Connect to Ultimate64 at IP and command it to start streaming Video and Audio.\n"
-			"       -U IP (default off)   Same as -u but don't stop the streaming when u64view exits.\n"
-			"       -I IP (default off)   Just know the IP, do nothing, so keys can be used for starting/stopping stream.\n"
-			"       -o FN (default off)   Output raw ARGB to FN.rgb and PCM to FN.pcm (20 MiB/s, you disk must keep up or packets are dropped).\n\n");
+	for(int w = lo >> 6; w <= hi >> 6; w++) {
+		uint64_t mask = ~(uint64_t)0;
+		if(w == lo >> 6) {
+			mask &= ~(uint64_t)0 << (lo & 63);
+		}
+		if(w == hi >> 6) {
+			mask &= ~(uint64_t)0 >> (63 - (hi & 63));
+		}
+		if(bm[w] & mask) {
+			return 1;
+		}
+	}
+	return 0;
 }
 
-void setUserColors(char *ucol)
+static int dbgIndexWorker(void *ptr)
 {
-	printf("Using user-provided colors: ");
-	int pos=0;
-	char colbyte[3] = {0,0,0 };
-	for(int i=0; i < 16; i++) {
-		colbyte[0] = ucol[pos];
-		pos++;
-		colbyte[1] = ucol[pos];
-		pos++;
-		ured[i] = strtol(colbyte, NULL, 16);
+	dbgWork_t *w = (dbgWork_t*)ptr;
 
-		colbyte[0] = ucol[pos];
-		pos++;
-		colbyte[1] = ucol[pos];
-		pos++;
-		ugreen[i] = strtol(colbyte, NULL, 16);
+	for(uint32_t b = w->first; b < w->last; b++) {
+		dbgBlock_t *blk = &w->blocks[b];
+		uint64_t firstPkg = (uint64_t)b * DBG_BLOCK_PACKETS;
+		uint64_t lastPkg = firstPkg + DBG_BLOCK_PACKETS;
+		uint64_t span = 0;
+		if(lastPkg > w->packets) {
+			lastPkg = w->packets;
+		}
 
-		colbyte[0] = ucol[pos];
-		pos++;
-		colbyte[1] = ucol[pos];
-		pos++;
-		ublue[i] = strtol(colbyte, NULL, 16);
+		memset(blk, 0, sizeof(dbgBlock_t));
+		uint16_t seq = ((d64msg_t*)dbgSlot(w->map, firstPkg))->seq;
+		for(uint64_t n = firstPkg; n < lastPkg; n++) {
+			d64msg_t *d = (d64msg_t*)dbgSlot(w->map, n);
+			int late;
+			span += dbgSeqStep(seq, d->seq, &late);
+			if(!late) {
+				seq = d->seq;
+			}
+			for(int i=0; i < DBG_ENTRIES; i++) {
+				uint32_t e = d->entry[i];
+				uint16_t addr = e & 0xffff;
+				blk->access[addr >> 6] |= (uint64_t)1 << (addr & 63);
+				if(!(e & DBG_RW_BIT)) {
+					blk->write[addr >> 6] |= (uint64_t)1 << (addr & 63);
+				}
+			}
+		}
+		// Relative to the first packet of the block for now, made absolute once all blocks are done
+		blk->lastCycle = span * DBG_ENTRIES + DBG_ENTRIES - 1;
+		w->endSeq[b] = seq;
+	}
 
-		pos++; // Skip character after 6 bytes
+	return 0;
+}
+
+// Build the block index in parallel, cycle numbers count lost packets so they stay true to the C64 timeline
+dbgBlock_t *buildDbgIndex(uint8_t *map, uint64_t packets, uint32_t *blockCount)
+{
+	int threads = SDL_GetCPUCount();
+	uint32_t count = (packets + DBG_BLOCK_PACKETS - 1) / DBG_BLOCK_PACKETS;
+	dbgBlock_t *blocks = malloc((size_t)count * sizeof(dbgBlock_t));
+	uint16_t *endSeq = malloc((size_t)count * sizeof(uint16_t));
+	dbgWork_t work[DBG_MAX_THREADS];
+	SDL_Thread *thr[DBG_MAX_THREADS];
+
+	if(!blocks || !endSeq) {
+		printf("Error: Could not allocate index for %u blocks.\n", count);
+		free(blocks);
+		free(endSeq);
+		return NULL;
 	}
 
-	printColors(ured, ugreen, ublue);
-	printf("\n");
+	if(threads > DBG_MAX_THREADS) {
+		threads = DBG_MAX_THREADS;
+	}
+
+	for(int t=0; t < threads; t++) {
+		memset(&work[t], 0, sizeof(dbgWork_t));
+		work[t].map = map;
+		work[t].packets = packets;
+		work[t].blocks = blocks;
+		work[t].endSeq = endSeq;
+		work[t].first = (uint64_t)count * t / threads;
+		work[t].last = (uint64_t)count * (t + 1) / threads;
+		thr[t] = SDL_CreateThread(dbgIndexWorker, "dbgindex", &work[t]);
+		if(!thr[t]) {
+			dbgIndexWorker(&work[t]);
+		}
+	}
+	for(int t=0; t < threads; t++) {
+		if(thr[t]) {
+			SDL_WaitThread(thr[t], NULL);
+		}
+	}
+
+	uint64_t cycle = 0;
+	for(uint32_t b=0; b < count; b++) {
+		uint16_t seq = ((d64msg_t*)dbgSlot(map, (uint64_t)b * DBG_BLOCK_PACKETS))->seq;
+		if(b) {
+			int late;
+			cycle += (uint64_t)dbgSeqStep(endSeq[b - 1], seq, &late) * DBG_ENTRIES;
+		}
+		blocks[b].firstCycle = cycle;
+		blocks[b].lastCycle += cycle;
+		cycle = blocks[b].lastCycle + 1 - DBG_ENTRIES;
+	}
+	free(endSeq);
+
+	*blockCount = count;
+	return blocks;
 }
 
-int parseArguments(int argc, char **argv, programData *data)
+static int dbgQueryWorker(void *ptr)
 {
-	opterr = 0;
-	int c;
+	dbgWork_t *w = (dbgWork_t*)ptr;
+	const dbgQuery_t *q = w->query;
 
-	while ((c = getopt (argc, argv, "hl:a:z:fsvVcmtT:u:U:I:o:")) != -1) {
-		switch(c) {
-			case 'l':
-				data->listen = atoi(optarg);
-				if (data->listen == 0) {
-					printf("Video port must be an integer larger than 0.\n");
-					return EXIT_FAILURE;
-				}
-				break;
-			case 'a':
-				data->listenaudio = atoi(optarg);
-				if (data->listenaudio == 0) {
-					printf("Audio port must be an integer larger than 0.\n");
-					return EXIT_FAILURE;
-				}
-				break;
-			case 'z':
-				data->scale = atoi(optarg);
-				if (data->scale == 0) {
-					printf("Scale must be an integer larger than 0.\n");
-					return EXIT_FAILURE;
-				}
-				break;
-			case 'f':
-				data->fullscreenFlag = SDL_WINDOW_FULLSCREEN_DESKTOP;
-				printf("Fullscreen is on.\n");
-				break;
-			case 's':
-				data->renderFlag = SDL_RENDERER_SOFTWARE;
-				break;
-			case 'v':
-				data->vsyncFlag = SDL_RENDERER_PRESENTVSYNC;
-				printf("Vsync is on.\n");
-				break;
-			case 'V':
-				data->verbose=1;
-				printf("Verbose is on.\n");
-				break;
-			case 'c':
-				data->fast = 0;
-				break;
-			case 'm':
-				data->audioFlag=0;
-				printf("Audio is off.\n");
-				break;
-			case 't':
-				data->curColors = DCOLORS;
-				printf("Using DusteDs CRT colors.\n");
-				break;
-			case 'T':
-				if (strlen(optarg) != USER_COLORS) {
-					printf("Error: Expected a string of exactly %i characters (see  -T without parameter to see examples)\n", USER_COLORS);
-					return EXIT_FAILURE;
-				}
-				setUserColors(optarg);
-				data->curColors = UCOLORS;
-				break;
-			case 'o':
-				data->verbose=1;
-				printf("Turning on verbose mode, so you can see if you miss any data!\n");
-				printf("Outputting video to %s.rgb and audio to %s.pcm ...\n", optarg, optarg);
-				printf( "\nTry encoding with:\n"
-						"ffmpeg -vcodec rawvideo -pix_fmt abgr -s 384x272 -r 50\\\n"
-						"  -i %s.rgb -f s16le -ar 47983 -ac 2 -i %s.pcm\\\n"
-						"  -vf scale=w=1920:h=1080:force_original_aspect_ratio=decrease\\\n"
-						"  -sws_flags neighbor -crf 15 -vcodec libx264 %s.avi\n\n", optarg, optarg, optarg);
+	for(uint32_t c = w->first; c < w->last; c++) {
+		uint32_t b = w->candidates[c];
+		uint64_t firstPkg = (uint64_t)b * DBG_BLOCK_PACKETS;
+		uint64_t lastPkg = firstPkg + DBG_BLOCK_PACKETS;
+		if(lastPkg > w->packets) {
+			lastPkg = w->packets;
+		}
 
-				sprintf(data->fnbuf, "%s.rgb", optarg);
-				data->vfp=fopen(data->fnbuf,"w");
-				if(!data->vfp) {
-					printf("Error opening %s for writing.\n", data->fnbuf);
-					return EXIT_FAILURE;
+		uint8_t *start = dbgSlot(w->map, firstPkg);
+		madvise((void*)((uintptr_t)start & ~(uintptr_t)4095), dbgSlot(w->map, lastPkg) - start + 4096, MADV_WILLNEED);
+
+		uint64_t cycle = w->blocks[b].firstCycle;
+		uint16_t seq = ((d64msg_t*)start)->seq;
+		for(uint64_t n = firstPkg; n < lastPkg; n++) {
+			d64msg_t *d = (d64msg_t*)dbgSlot(w->map, n);
+			int late;
+			cycle += (uint64_t)dbgSeqStep(seq, d->seq, &late) * DBG_ENTRIES;
+			if(!late) {
+				seq = d->seq;
+			}
+			if(cycle + DBG_ENTRIES <= q->fromCycle || cycle > q->toCycle) {
+				continue;
+			}
+			for(int i=0; i < DBG_ENTRIES; i++) {
+				uint32_t e = d->entry[i];
+				uint16_t addr = e & 0xffff;
+				if(addr < q->lo || addr > q->hi || cycle + i < q->fromCycle || cycle + i > q->toCycle) {
+					continue;
 				}
-				sprintf(data->fnbuf, "%s.pcm", optarg);
-				data->afp=fopen(data->fnbuf,"w");
-				if(!data->afp) {
-					printf("Error opening %s for writing.\n", data->fnbuf);
-					fclose(data->vfp);
-					return EXIT_FAILURE;
+				if((q->type == 'w' && (e & DBG_RW_BIT)) || (q->type == 'r' && !(e & DBG_RW_BIT))) {
+					continue;
 				}
-				break;
-			case 'u':
-				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
-				break;
-			case 'U':
-				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
-				data->stopStreamOnExit=0;
-				break;
-			case 'I':
-				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
-				data->stopStreamOnExit=0;
-				data->startStreamOnStart=0;
-				break;
-			case '?':
-				if (optopt == 'l' || optopt == 'a' || optopt == 'z' ||
-				    optopt == 'u' || optopt  == 'U' || optopt == 'I') {
-					printf("Option -%c requires an argument.\n", optopt);
-					return EXIT_FAILURE;
-				} else if (optopt == 'T') {
-					printf("User-defined color option (-T):\n\n    Default colors: ");
-					printColors(sred, sgreen, sblue);
-					printf("\n    DusteDs colors: ");
-					printColors(dred, dgreen, dblue);
-					printf("\n\n    If you want to use your own color values, just type them after -T in the format shown above (RGB24 in hex, like HTML, and comma between each color).\n"
-							"    The colors are, in order: black, white, red, cyan, purple, green, blue, yellow, orange, brown, pink, dark-grey, grey, light-green, light-blue, light-grey.\n"
-							"    Example: DusteDs colors, with a slightly darker blue: -T 060a0b,f2f1f1,b63c47,a2f7ed,af45d7,86f964,0030Ef,f8fe8a,d06e28,794e00,fb918f,5e6e69,a3b6ad,d1fcc5,6eb3ff,dce2db\n\n\n");
-					return EXIT_FAILURE;
-				} else {
-					printf("Invalid argument '-%c'\n", optopt);
+				if(w->numMatches == w->maxMatches) {
+					w->maxMatches = w->maxMatches ? w->maxMatches * 2 : 1024;
+					dbgMatch_t *m = realloc(w->matches, w->maxMatches * sizeof(dbgMatch_t));
+					if(!m) {
+						printf("Error: Out of memory while collecting matches.\n");
+						return -1;
+					}
+					w->matches = m;
 				}
-				return EXIT_FAILURE;
-			case 'h':
-			/* fall through */
-			default:
-				printHelp();
-				return EXIT_FAILURE;
+				w->matches[w->numMatches].cycle = cycle + i;
+				w->matches[w->numMatches].entry = e;
+				w->numMatches++;
+			}
 		}
 	}
 
+	return 0;
+}
+
+// A 16 bit hex address, no sign and nothing that doesn't fit
+static int parseDbgAddress(const char *s, char **end, int *addr)
+{
+	if(!isxdigit((unsigned char)*s)) {
+		*end = (char*)s;
+		return EXIT_FAILURE;
+	}
+	unsigned long v = strtoul(s, end, 16);
+	if(v > 0xffff) {
+		return EXIT_FAILURE;
+	}
+	*addr = (int)v;
 	return EXIT_SUCCESS;
 }
 
-int setupStream(programData *data)
+// Parse TYPE:ADDR[-ADDR][@FROM-TO], TYPE is r, w or a(ny), addresses in hex, cycles in decimal
+int parseDbgQuery(const char *spec, dbgQuery_t *q)
 {
-	int sdl_init = 0;
-	int sdl_net_init = 0;
-	setColors(data);
+	char *end;
 
-	data->pkg = SDLNet_AllocPacket(sizeof(u64msg_t));
-	data->audpkg = SDLNet_AllocPacket(sizeof(a64msg_t));
+	memset(q, 0, sizeof(dbgQuery_t));
+	q->toCycle = UINT64_MAX;
 
-	// Initialize SDL2
-	sdl_init = SDL_Init(SDL_INIT_VIDEO|data->audioFlag);
-	if (sdl_init != 0) {
-		printf("SDL_Init Error: %s\n", SDL_GetError());
-		goto clean_up;
+	if(strlen(spec) < 3 || (spec[0] != 'r' && spec[0] != 'w' && spec[0] != 'a') || spec[1] != ':') {
+		return EXIT_FAILURE;
 	}
+	q->type = spec[0];
 
-	sdl_net_init = SDLNet_Init();
-	if(sdl_net_init == -1) {
-		printf("SDLNet_Init: %s\n", SDLNet_GetError());
-		goto clean_up;
+	if(parseDbgAddress(spec + 2, &end, &q->lo) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
 	}
-
-	if(strlen(data->hostName) && data->startStreamOnStart) {
-		if (runCommand(data, CMD_START_STREAM) != EXIT_SUCCESS) {
-			goto clean_up;
+	q->hi = q->lo;
+	if(*end == '-' && parseDbgAddress(end + 1, &end, &q->hi) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	if(*end == '@') {
+		q->fromCycle = strtoull(end + 1, &end, 10);
+		if(*end != '-') {
+			return EXIT_FAILURE;
 		}
+		q->toCycle = strtoull(end + 1, &end, 10);
 	}
 
-	data->set=SDLNet_AllocSocketSet(2);
-	if(!data->set) {
-		printf("SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
-		goto clean_up;
+	if(*end || q->lo > q->hi || q->fromCycle > q->toCycle) {
+		return EXIT_FAILURE;
 	}
 
-	printf("Opening UDP socket on port %i for video...\n", data->listen);
-	data->udpsock=SDLNet_UDP_Open(data->listen);
-	if(!data->udpsock) {
-		printf("SDLNet_UDP_Open: %s\n", SDLNet_GetError());
-		goto clean_up;
+	return EXIT_SUCCESS;
+}
+
+int queryDebugCapture(programData *data)
+{
+#ifdef _WIN32
+	printf("Debug capture queries are not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	dbgQuery_t q;
+	dbgHeader_t hdr;
+	dbgBlock_t *blocks = NULL;
+	uint32_t *candidates = NULL;
+	uint32_t blockCount = 0;
+	uint32_t numCandidates = 0;
+	dbgWork_t work[DBG_MAX_THREADS];
+	SDL_Thread *thr[DBG_MAX_THREADS];
+	int threads = SDL_GetCPUCount();
+	int result = EXIT_FAILURE;
+	uint64_t numMatches = 0;
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	if(parseDbgQuery(data->dbgQuery, &q) != EXIT_SUCCESS) {
+		printf("Error: Invalid query '%s', expected TYPE:ADDR[-ADDR][@FROM-TO], like w:d020 or a:c000-cfff@0-985248\n", data->dbgQuery);
+		return EXIT_FAILURE;
 	}
 
-	if( SDLNet_UDP_AddSocket(data->set, data->udpsock) == -1 ) {
-		printf("SDLNet_UDP_AddSocket error: %s\n", SDLNet_GetError());
-		goto clean_up;
+	int fd = open(data->dbgFile, O_RDONLY);
+	if(fd == -1) {
+		printf("Error opening %s for reading.\n", data->dbgFile);
+		return EXIT_FAILURE;
 	}
+	off_t fileSize = lseek(fd, 0, SEEK_END);
 
-	if(data->audioFlag) {
-		printf("Opening UDP socket on port %i for audio...\n", data->listenaudio);
-		data->audiosock=SDLNet_UDP_Open(data->listenaudio);
-		if(!data->audiosock) {
-			printf("SDLNet_UDP_Open: %s\n", SDLNet_GetError());
-			goto clean_up;
-		}
+	if(fileSize < DBG_HEADER_SIZE || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	   memcmp(hdr.magic, DBG_MAGIC, sizeof(hdr.magic)) || hdr.packetSize != sizeof(d64msg_t) ||
+	   DBG_HEADER_SIZE + hdr.packets * sizeof(d64msg_t) > fileSize) {
+		printf("Error: %s is not a debug stream capture.\n", data->dbgFile);
+		close(fd);
+		return EXIT_FAILURE;
+	}
 
-		if( SDLNet_UDP_AddSocket(data->set, data->audiosock) == -1 ) {
-			printf("SDLNet_UDP_AddSocket error: %s\n", SDLNet_GetError());
-			goto clean_up;
-		}
+	uint8_t *map = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		printf("Error: Could not map %s.\n", data->dbgFile);
+		return EXIT_FAILURE;
+	}
 
-		SDL_memset(&data->want, 0, sizeof(data->want));
-		data->want.freq = AUDIO_FREQUENCY;
-		data->want.format = AUDIO_S16LSB;
-		data->want.channels = AUDIO_CHANNELS;
-		data->want.samples = AUDIO_SAMPLES;
-		data->dev = SDL_OpenAudioDevice(NULL, 0, &data->want, &data->have, 0);
+	if(!hdr.packets) {
+		printf("0 matches, %s is empty.\n", data->dbgFile);
+		munmap(map, fileSize);
+		return EXIT_SUCCESS;
+	}
 
-		if(data->dev==0) {
-			printf("Failed to open audio: %s", SDL_GetError());
+	if(hdr.version >= 2 && hdr.indexOffset && hdr.blockPackets == DBG_BLOCK_PACKETS &&
+	   hdr.indexOffset + (uint64_t)hdr.blockCount * sizeof(dbgBlock_t) <= fileSize) {
+		blocks = (dbgBlock_t*)(map + hdr.indexOffset);
+		blockCount = hdr.blockCount;
+	} else {
+		printf("No index in %s, building it...\n", data->dbgFile);
+		madvise(map, fileSize, MADV_SEQUENTIAL);
+		blocks = buildDbgIndex(map, hdr.packets, &blockCount);
+		if(!blocks) {
+			goto clean_up;
 		}
-
-		SDL_PauseAudioDevice(data->dev, 0);
+		madvise(map, fileSize, MADV_RANDOM);
 	}
 
-	// Create a window
-	data->win = SDL_CreateWindow("Ultimate 64 view!", 100, 100, data->width*data->scale,
-				data->height*data->scale, SDL_WINDOW_SHOWN | data->fullscreenFlag | SDL_WINDOW_RESIZABLE);
-	if (data->win == NULL) {
-		printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
+	candidates = malloc((size_t)blockCount * sizeof(uint32_t));
+	if(!candidates) {
+		printf("Error: Out of memory.\n");
 		goto clean_up;
 	}
-	// Set icon
-	SDL_Surface *iconSurface = SDL_CreateRGBSurfaceFrom(iconPixels,32,32,32,32*4, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
-	SDL_SetWindowIcon(data->win, iconSurface);
-	SDL_FreeSurface(iconSurface);
+	for(uint32_t b=0; b < blockCount; b++) {
+		if(blocks[b].lastCycle < q.fromCycle || blocks[b].firstCycle > q.toCycle) {
+			continue;
+		}
+		if(bitmapAnyInRange(q.type == 'w' ? blocks[b].write : blocks[b].access, q.lo, q.hi)) {
+			candidates[numCandidates++] = b;
+		}
+	}
 
-	// Create a renderer
-	data->ren = SDL_CreateRenderer(data->win, -1, (data->vsyncFlag | data->renderFlag));
-	if (data->ren == NULL) {
-		printf("SDL_CreateRenderer Error: %s\n", SDL_GetError());
-		goto clean_up;
+	if(threads > DBG_MAX_THREADS) {
+		threads = DBG_MAX_THREADS;
+	}
+	for(int t=0; t < threads; t++) {
+		memset(&work[t], 0, sizeof(dbgWork_t));
+		work[t].map = map;
+		work[t].packets = hdr.packets;
+		work[t].blocks = blocks;
+		work[t].candidates = candidates;
+		work[t].query = &q;
+		work[t].first = (uint64_t)numCandidates * t / threads;
+		work[t].last = (uint64_t)numCandidates * (t + 1) / threads;
+		thr[t] = SDL_CreateThread(dbgQueryWorker, "dbgquery", &work[t]);
+		if(!thr[t]) {
+			dbgQueryWorker(&work[t]);
+		}
 	}
 
-	data->tex = SDL_CreateTexture(data->ren,
-				SDL_PIXELFORMAT_RGBA8888,
-				SDL_TEXTUREACCESS_STREAMING,
-				data->width,
-				data->height);
+	result = EXIT_SUCCESS;
+	for(int t=0; t < threads; t++) {
+		int r = 0;
+		if(thr[t]) {
+			SDL_WaitThread(thr[t], &r);
+		}
+		if(r) {
+			result = EXIT_FAILURE;
+		}
+	}
 
-	if( SDL_LockTexture(data->tex, NULL, (void**)&data->pixels, &data->pitch) ) {
-		printf("Failed to lock texture for writing");
+	double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+	// Each worker got a consecutive run of blocks, so printing them in order keeps the cycles sorted
+	for(int t=0; t < threads; t++) {
+		for(uint64_t i=0; i < work[t].numMatches; i++) {
+			uint32_t e = work[t].matches[i].entry;
+			printf("%14"PRIu64" %04x %02x %c %02x\n", work[t].matches[i].cycle, e & 0xffff,
+				(e >> 16) & 0xff, (e & DBG_RW_BIT) ? 'r' : 'w', e >> 25);
+		}
+		numMatches += work[t].numMatches;
+		free(work[t].matches);
 	}
 
-	return EXIT_SUCCESS;
+	printf("%"PRIu64" matches, scanned %u of %u blocks using %i threads in %.1f ms.\n",
+		numMatches, numCandidates, blockCount, threads, ms);
 
 clean_up:
-	if (data->pkg) {
-		SDLNet_FreePacket(data->pkg);
+	if(blocks && (uint8_t*)blocks != map + hdr.indexOffset) {
+		free(blocks);
 	}
-	if (data->audpkg) {
-		SDLNet_FreePacket(data->audpkg);
+	free(candidates);
+	munmap(map, fileSize);
+
+	return result;
+#endif
+}
+
+void stopDebugCapture(programData *data)
+{
+#ifndef _WIN32
+	if(data->dbgThread) {
+		SDL_AtomicSet(&data->dbgRun, 0);
+		SDL_WaitThread(data->dbgThread, NULL);
+		data->dbgThread = NULL;
 	}
-	if (data->set) {
-		SDLNet_FreeSocketSet(data->set);
+
+	if(data->dbgPkgs) {
+		for(int i=0; i < DBG_RECV_BATCH; i++) {
+			data->dbgPkgs[i]->data = data->dbgPkgBufs[i];
+		}
+		SDLNet_FreePacketV(data->dbgPkgs);
+		data->dbgPkgs = NULL;
 	}
-	if (data->udpsock) {
-		SDLNet_UDP_Close(data->udpsock);
+	if(data->dbgSock) {
+		SDLNet_UDP_Close(data->dbgSock);
+		data->dbgSock = NULL;
 	}
-	if (data->audiosock) {
-		SDLNet_UDP_Close(data->audiosock);
+	if(data->dbgSet) {
+		SDLNet_FreeSocketSet(data->dbgSet);
+		data->dbgSet = NULL;
 	}
-	if (data->tex) {
-		SDL_DestroyTexture(data->tex);
+
+	if(data->dbgMap) {
+		dbgHeader_t hdr;
+		dbgBlock_t *blocks = NULL;
+		uint32_t blockCount = 0;
+		memcpy(&hdr, data->dbgMap, sizeof(hdr));
+		uint64_t used = DBG_HEADER_SIZE + hdr.packets * sizeof(d64msg_t);
+
+		if(hdr.packets) {
+			printf("Indexing debug capture...\n");
+			blocks = buildDbgIndex(data->dbgMap, hdr.packets, &blockCount);
+		}
+		munmap(data->dbgMap, data->dbgCaptureSize);
+		data->dbgMap = NULL;
+
+		// Give back the part of the preallocation that was never used, and put the index after the packets
+		if(ftruncate(data->dbgFd, used)) {
+			printf("Error truncating %s.\n", data->dbgFile);
+		}
+		if(blocks) {
+			size_t indexSize = (size_t)blockCount * sizeof(dbgBlock_t);
+			uint64_t indexOffset = (used + 4095) & ~(uint64_t)4095;
+			if(pwrite(data->dbgFd, blocks, indexSize, indexOffset) == indexSize) {
+				hdr.indexOffset = indexOffset;
+				hdr.blockCount = blockCount;
+				hdr.blockPackets = DBG_BLOCK_PACKETS;
+				if(pwrite(data->dbgFd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+					printf("Error writing header to %s.\n", data->dbgFile);
+				}
+			} else {
+				printf("Error writing index to %s.\n", data->dbgFile);
+			}
+			free(blocks);
+		}
 	}
-	if (data->ren) {
-		SDL_DestroyRenderer(data->ren);
+	if(data->dbgFd != -1) {
+		close(data->dbgFd);
+		data->dbgFd = -1;
 	}
-	if (data->win) {
-		SDL_DestroyWindow(data->win);
+#endif
+}
+
+int startDebugCapture(programData *data)
+{
+#ifdef _WIN32
+	printf("Debug stream capture is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	dbgHeader_t hdr;
+
+	data->dbgFd = open(data->dbgFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(data->dbgFd == -1) {
+		printf("Error opening %s for writing.\n", data->dbgFile);
+		return EXIT_FAILURE;
 	}
-	if (sdl_net_init) {
-		SDLNet_Quit();
+
+	// Reserve all the blocks up front, so a full disk shows up now and not as a SIGBUS halfway through
+	if(posix_fallocate(data->dbgFd, 0, data->dbgCaptureSize)) {
+		printf("Error: Could not preallocate %"PRIu64" bytes for %s.\n", data->dbgCaptureSize, data->dbgFile);
+		goto clean_up;
 	}
-	if (sdl_init) {
-		SDL_Quit();
+
+	data->dbgMap = mmap(NULL, data->dbgCaptureSize, PROT_READ | PROT_WRITE, MAP_SHARED, data->dbgFd, 0);
+	if(data->dbgMap == MAP_FAILED) {
+		data->dbgMap = NULL;
+		printf("Error: Could not map %s.\n", data->dbgFile);
+		goto clean_up;
 	}
+	madvise(data->dbgMap, data->dbgCaptureSize, MADV_SEQUENTIAL);
 
-	return EXIT_FAILURE;
-}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DBG_MAGIC, sizeof(hdr.magic));
+	hdr.version = DBG_VERSION;
+	hdr.packetSize = sizeof(d64msg_t);
+	memcpy(data->dbgMap, &hdr, sizeof(hdr));
 
-void runStream(programData *data)
-{
-	SDL_Event event;
-	int run = 1;
-	int sync = 1;
-	int staleVideo=7;
-	int r = 0;
-	uint16_t lastAseq=0;
-	uint16_t lastVseq=0;
+	data->dbgPkgs = SDLNet_AllocPacketV(DBG_RECV_BATCH + 1, sizeof(d64msg_t));
+	if(!data->dbgPkgs) {
+		printf("SDLNet_AllocPacketV: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+	// The packets are received straight into the map, keep the allocated buffers so they can be freed
+	for(int i=0; i < DBG_RECV_BATCH; i++) {
+		data->dbgPkgBufs[i] = data->dbgPkgs[i]->data;
+	}
 
-	pic(data->tex, data->width, data->height, data->pitch, data->pixels);
-	while (run) {
-		while (SDL_PollEvent(&event)) {
-			switch (event.type) {
-			case SDL_KEYDOWN:
-				switch (event.key.keysym.sym) {
-				case SDLK_ESCAPE:
-					run = 0;
+	data->dbgSet = SDLNet_AllocSocketSet(1);
+	if(!data->dbgSet) {
+		printf("SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+
+	printf("Opening UDP socket on port %i for debug stream, capturing up to %"PRIu64" MiB to %s...\n",
+		DEFAULT_LISTENDEBUG_PORT, data->dbgCaptureSize / (1024 * 1024), data->dbgFile);
+	data->dbgSock = SDLNet_UDP_Open(DEFAULT_LISTENDEBUG_PORT);
+	if(!data->dbgSock) {
+		printf("SDLNet_UDP_Open: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+	SDLNet_UDP_AddSocket(data->dbgSet, data->dbgSock);
+
+	SDL_AtomicSet(&data->dbgRun, 1);
+	data->dbgThread = SDL_CreateThread(debugCaptureThread, "debugcapture", data);
+	if(!data->dbgThread) {
+		printf("Error creating debug capture thread: %s\n", SDL_GetError());
+		goto clean_up;
+	}
+
+	return EXIT_SUCCESS;
+
+clean_up:
+	stopDebugCapture(data);
+	return EXIT_FAILURE;
+#endif
+}
+
+// Raw packet capture, every video and audio datagram as it arrived, to reproduce what the display did
+void stopPacketCapture(programData *data)
+{
+#ifndef _WIN32
+	if(data->pktMap) {
+		pktHeader_t *hdr = (pktHeader_t*)data->pktMap;
+		hdr->records = data->pktRecords;
+		hdr->used = data->pktUsed;
+		munmap(data->pktMap, data->dbgCaptureSize);
+		data->pktMap = NULL;
+
+		if(ftruncate(data->pktFd, data->pktUsed)) {
+			printf("Error truncating %s.\n", data->pktFile);
+		}
+		printf("Packet capture: %"PRIu64" packets (%"PRIu64" bytes) written to %s.\n", data->pktRecords, data->pktUsed, data->pktFile);
+	}
+	if(data->pktFd != -1) {
+		close(data->pktFd);
+		data->pktFd = -1;
+	}
+
+	if(data->replayMap) {
+		munmap(data->replayMap, data->replaySize);
+		data->replayMap = NULL;
+	}
+#endif
+}
+
+int startPacketCapture(programData *data)
+{
+#ifdef _WIN32
+	printf("Packet capture is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	pktHeader_t *hdr;
+
+	data->pktFd = open(data->pktFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(data->pktFd == -1) {
+		printf("Error opening %s for writing.\n", data->pktFile);
+		return EXIT_FAILURE;
+	}
+
+	if(posix_fallocate(data->pktFd, 0, data->dbgCaptureSize)) {
+		printf("Error: Could not preallocate %"PRIu64" bytes for %s.\n", data->dbgCaptureSize, data->pktFile);
+		goto clean_up;
+	}
+
+	data->pktMap = mmap(NULL, data->dbgCaptureSize, PROT_READ | PROT_WRITE, MAP_SHARED, data->pktFd, 0);
+	if(data->pktMap == MAP_FAILED) {
+		data->pktMap = NULL;
+		printf("Error: Could not map %s.\n", data->pktFile);
+		goto clean_up;
+	}
+	madvise(data->pktMap, data->dbgCaptureSize, MADV_SEQUENTIAL);
+
+	hdr = (pktHeader_t*)data->pktMap;
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, PKT_MAGIC, sizeof(hdr->magic));
+	hdr->version = PKT_VERSION;
+	hdr->frequency = SDL_GetPerformanceFrequency();
+	data->pktUsed = sizeof(pktHeader_t);
+	data->pktRecords = 0;
+	data->pktStart = SDL_GetPerformanceCounter();
+
+	printf("Capturing video and audio packets, up to %"PRIu64" MiB to %s...\n", data->dbgCaptureSize / (1024 * 1024), data->pktFile);
+	return EXIT_SUCCESS;
+
+clean_up:
+	stopPacketCapture(data);
+	return EXIT_FAILURE;
+#endif
+}
+
+// Called right after the receive, the timestamp is as close to the arrival as SDL_net lets us get
+static inline void capturePacket(programData *data, pktKind kind, const UDPpacket *pkg)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+	uint64_t size = sizeof(pktRecord_t) + PKT_ALIGN(pkg->len);
+
+	if(unlikely(data->pktUsed + size > data->dbgCaptureSize)) {
+		if(!data->pktFull) {
+			data->pktFull = 1;
+			printf("Packet capture file %s is full, stopping capture.\n", data->pktFile);
+		}
+		return;
+	}
+
+	pktRecord_t *rec = (pktRecord_t*)(data->pktMap + data->pktUsed);
+	rec->time = now - data->pktStart;
+	rec->host = pkg->address.host;
+	rec->len = pkg->len;
+	rec->kind = kind;
+	rec->reserved = 0;
+	memcpy(rec->payload, pkg->data, pkg->len);
+	data->pktUsed += size;
+	data->pktRecords++;
+}
+
+int startReplay(programData *data)
+{
+#ifdef _WIN32
+	printf("Packet replay is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	struct stat st;
+	pktHeader_t hdr;
+	int fd = open(data->replayFile, O_RDONLY);
+
+	if(fd == -1) {
+		printf("Error opening %s for reading.\n", data->replayFile);
+		return EXIT_FAILURE;
+	}
+	if(fstat(fd, &st) || st.st_size < (off_t)sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	   memcmp(hdr.magic, PKT_MAGIC, sizeof(hdr.magic)) || hdr.version != PKT_VERSION || hdr.used > (uint64_t)st.st_size) {
+		printf("Error: %s is not a packet capture this version can read.\n", data->replayFile);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	data->replaySize = st.st_size;
+	data->replayMap = mmap(NULL, data->replaySize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data->replayMap == MAP_FAILED) {
+		data->replayMap = NULL;
+		printf("Error: Could not map %s.\n", data->replayFile);
+		return EXIT_FAILURE;
+	}
+	madvise(data->replayMap, data->replaySize, MADV_SEQUENTIAL);
+
+	// A capture that was not closed properly has no count, replay what is there until the first empty record
+	data->replayEnd = hdr.used ? hdr.used : data->replaySize;
+	data->replayPos = sizeof(hdr);
+	data->replayScale = (double)SDL_GetPerformanceFrequency() / hdr.frequency;
+	data->replayStart = 0;
+
+	printf("Replaying %"PRIu64" packets from %s with their original timing...\n", hdr.records, data->replayFile);
+	return EXIT_SUCCESS;
+#endif
+}
+
+static inline const pktRecord_t *replayPeek(programData *data)
+{
+	const pktRecord_t *rec;
+
+	while(data->replayPos + sizeof(pktRecord_t) <= data->replayEnd) {
+		rec = (const pktRecord_t*)(data->replayMap + data->replayPos);
+		if(unlikely(rec->len == 0 || data->replayPos + sizeof(pktRecord_t) + rec->len > data->replayEnd)) {
+			break;
+		}
+		// Without audio the audio packets would block the video ones behind them
+		if(unlikely(rec->kind == PKT_AUDIO && !data->audioFlag)) {
+			data->replayPos += sizeof(pktRecord_t) + PKT_ALIGN(rec->len);
+			continue;
+		}
+		// Nor may a record that fits no packet, it could never be handed out
+		if(unlikely((rec->kind != PKT_VIDEO && rec->kind != PKT_AUDIO) ||
+		            rec->len > ((rec->kind == PKT_VIDEO) ? sizeof(u64msg_t) : sizeof(a64msg_t)))) {
+			data->replayPos += sizeof(pktRecord_t) + PKT_ALIGN(rec->len);
+			data->replaySkipped++;
+			continue;
+		}
+		return rec;
+	}
+
+	if(!data->replayDone) {
+		data->replayDone = 1;
+		if(data->replaySkipped) {
+			printf("Replay finished, skipped %"PRIu64" records that were too big or of an unknown kind.\n", data->replaySkipped);
+		} else {
+			printf("Replay finished.\n");
+		}
+	}
+	return NULL;
+}
+
+// Seconds until the next captured packet is due, or -1 when there are none left
+static double replayNextDue(programData *data)
+{
+	const pktRecord_t *rec = replayPeek(data);
+
+	if(!rec) {
+		return -1;
+	}
+	double due = (rec->time * data->replayScale - (double)(SDL_GetPerformanceCounter() - data->replayStart)) / SDL_GetPerformanceFrequency();
+	return (due < 0) ? 0 : due;
+}
+
+// Hands out the captured packets in the order they arrived, each once its time has come
+static int replayPacket(programData *data, pktKind kind, UDPpacket *pkg)
+{
+	const pktRecord_t *rec = replayPeek(data);
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	if(unlikely(!data->replayStart)) {
+		data->replayStart = now;
+	}
+
+	if(!rec || rec->kind != kind || rec->len > pkg->maxlen || rec->time * data->replayScale > (double)(now - data->replayStart)) {
+		return 0;
+	}
+
+	memcpy(pkg->data, rec->payload, rec->len);
+	pkg->len = rec->len;
+	pkg->address.host = rec->host;
+	pkg->address.port = 0;
+	data->replayPos += sizeof(pktRecord_t) + PKT_ALIGN(rec->len);
+	return 1;
+}
+
+static inline int receivePacket(programData *data, pktKind kind, UDPsocket sock, UDPpacket *pkg)
+{
+	if(unlikely(data->replayMap)) {
+		return replayPacket(data, kind, pkg);
+	}
+
+	int r = SDLNet_UDP_Recv(sock, pkg);
+	if(unlikely(r == 1 && data->pktMap)) {
+		capturePacket(data, kind, pkg);
+	}
+	return r;
+}
+
+void printColors(const uint64_t *red, const uint64_t *green, const uint64_t *blue)
+{
+	for(int i=0; i < 16; i++) {
+		printf("%02x%02x%02x%c", (int)red[i], (int)green[i],(int)blue[i], ((i==15)?' ':',') );
+	}
+
+}
+
+void printHelp(void)
+{
+	printf("\nUsage: u64view [-l N] [-a N] [-z N |-f] [-s] [-v] [-V] [-c] [-m] [-N] [-t] [-T [RGB,...]] [-u IP | -U IP -I IP] [-o FN] [-O FN | -X FN | -x FN | -E FN] [-M FN] [-g N] [-G N] [-k] [-w] [-y FN] [-Y FN] [-e P] [-S FN] [-n N] [-H N] [-r FN] [-L FN] [-d FN [-D N | -Q Q]] [-p FN | -P FN] [-j N] [-b N] [-R N] [-B]\n"
+			"       -l N  (default 11000) Video port number.\n"
+			"       -a N  (default 11001) Audio port number.\n"
+			"       -z N  (default 1)     Scale the window to N times size, N must be an integer.\n"
+			"       -f    (default off)   Fullscreen, will stretch.\n"
+			"       -s    (default off)   Prefer software rendering, more cpu intensive.\n"
+			"       -v    (default off)   Use vsync.\n"
+			"       -V    (default off)   Verbose output, tell when packets are dropped, how much data was transferred.\n"
+			"       -c    (default off)   Use more versatile drawing method, more cpu intensive, can't scale.\n"
+			"       -m    (default off)   Completely turn off audio.\n"
+			"       -N    (default off)   Headless, no window and no sound, for recording or piping on a machine without a display.\n"
+			"                             Ctrl+C stops, SIGUSR1 stops and starts recording like o, SIGUSR2 saves history like i.\n"
+			"       -j N  (default 40)    Keep N ms of audio queued, to ride out network jitter.\n"
+			"       -b N  (default 192)   Audio device buffer size in samples, lower for less latency if your sound card keeps up.\n"
+			"       -R N  (default 48000) Ask for this audio device rate (8000-192000), the device may pick another, audio is resampled to match.\n"
+			"       -B    (default off)   Benchmark the audio resampler and check its accuracy, then exit.\n"
+			"       -t    (default off)   Use colors that look more like DusteDs TV instead of the 'real' colors.\n"
+			"       -T [] (default off)   No argument: Show color values and help for -T\n"
+			"       -u IP (default off)   Connect to Ultimate64 at IP and command it to start streaming Video and Audio.\n"
+			"       -U IP (default off)   Same as -u but don't stop the streaming when u64view exits.\n"
+			"       -I IP (default off)   Just know the IP, do nothing, so keys can be used for starting/stopping stream.\n"
+			"       -o FN (default off)   Output raw ARGB to FN.rgb and PCM to FN.pcm (20 MiB/s, if your disk can't keep up frames are dropped).\n"
+			"       -O FN (default off)   Record frames, palette and audio to FN.u64, with timestamps and frame numbers.\n"
+			"                             Frames are delta and entropy coded, with a keyframe every second.\n"
+			"       -M FN (default off)   Record to FN.mkv, Matroska with the 16 color frames and PCM audio, timed and indexed,\n"
+			"                             so it plays and encodes without any options. Changing colors goes on in FN-part2.mkv\n"
+			"                             and so on, the other recordings keep going in the same file.\n"
+			"       -g N  (default off)   Split recordings into segments of N seconds, named FN-0001, FN-0002 and so on.\n"
+			"       -G N  (default off)   Split recordings into segments of about N MiB.\n"
+			"       -k    (default off)   Don't start recording until o is pressed, o stops and starts recording at any time.\n"
+			"                             Each start goes to a new segment.\n"
+			"       -w    (default off)   Push recordings to disk as they are written and keep them out of the page cache,\n"
+			"                             for long sessions. -V reports how long writes take.\n"
+			"       -y FN (default off)   Write video as YUV4MPEG2 (4:4:4) to the pipe FN as it comes in, - for stdout.\n"
+			"       -Y FN (default off)   Write audio as raw s16le stereo at 47983 Hz to the pipe FN, - for stdout.\n"
+			"       -e P  (default 50)    When a pipe reader is slow: block waits for it, drop drops what it isn't ready for,\n"
+			"                             a number N buffers that many frames before dropping. Only block can cause network loss.\n"
+			"       -S FN (default off)   Name screenshots FN-0001.png and so on, not u64view-0001.png. x saves the frame shown\n"
+			"                             as a 4 bit PNG.\n"
+			"       -n N  (default 50)    Shift+x saves each of the next N frames shown, for looking at sprites and rasters.\n"
+			"       -X FN (default off)   Expand FN.u64 to FN.rgb, FN.pcm and FN.sync like -o writes them, then exit.\n"
+			"       -x FN (default off)   Transcode FN.rgb and FN.pcm written by -o into FN.u64 on all cores, check it decodes to the same, then exit.\n"
+			"       -E FN (default off)   Benchmark the recording codec on the frames in FN.u64, then exit.\n"
+			"       -H N  (default off)   Keep the last N seconds in memory (3.2 MiB/s), press i to save them to a .u64 file.\n"
+			"                             Space pauses, left/right step a frame, page up/down jump 5 s, l goes back to live.\n"
+			"       -r FN (default off)   Play FN.u64, or FN.rgb with FN.pcm, with seeking, speed control and looping.\n"
+			"       -p FN (default off)   Capture every video and audio packet with its arrival time to FN, preallocates -D MiB.\n"
+			"       -P FN (default off)   Replay a capture made with -p instead of listening to the network, with the original timing.\n"
+			"       -L FN (default off)   Load and run FN (.prg, .d64, .g64, .d71, .g71, .d81) on the Ultimate64, needs -u, -U or -I.\n"
+			"                             Files can also be dropped onto the window.\n\n");
+}
+
+void setUserColors(char *ucol)
+{
+	printf("Using user-provided colors: ");
+	int pos=0;
+	char colbyte[3] = {0,0,0 };
+	for(int i=0; i < 16; i++) {
+		colbyte[0] = ucol[pos];
+		pos++;
+		colbyte[1] = ucol[pos];
+		pos++;
+		ured[i] = strtol(colbyte, NULL, 16);
+
+		colbyte[0] = ucol[pos];
+		pos++;
+		colbyte[1] = ucol[pos];
+		pos++;
+		ugreen[i] = strtol(colbyte, NULL, 16);
+
+		colbyte[0] = ucol[pos];
+		pos++;
+		colbyte[1] = ucol[pos];
+		pos++;
+		ublue[i] = strtol(colbyte, NULL, 16);
+
+		pos++; // Skip character after 6 bytes
+	}
+
+	printColors(ured, ugreen, ublue);
+	printf("\n");
+}
+
+int parseArguments(int argc, char **argv, programData *data)
+{
+	opterr = 0;
+	int c;
+
+	while ((c = getopt (argc, argv, "hl:a:z:fsvVcmNtT:u:U:I:o:O:X:x:E:M:wg:G:ky:Y:e:S:n:H:r:L:d:D:Q:p:P:j:b:R:B")) != -1) {
+		switch(c) {
+			case 'l':
+				data->listen = atoi(optarg);
+				if (data->listen == 0) {
+					printf("Video port must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
 				break;
-				case SDLK_c:
-					data->showHelp=0;
-					data->curColors++;
-					if(data->curColors == NUM_OF_COLORSCHEMES) {
-						data->curColors=SCOLORS;
-					}
-					setColors(data);
+			case 'a':
+				data->listenaudio = atoi(optarg);
+				if (data->listenaudio == 0) {
+					printf("Audio port must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
 				break;
-				case SDLK_s:
-					data->showHelp=0;
-					if(!strlen(data->hostName)) {
-						printf("Can only start/stop stream when started with -u, -U or -I.\n");
-					} else {
-						if(data->isStreaming) {
-							if (runCommand(data, CMD_STOP_STREAM) != EXIT_SUCCESS) {
-								run = 0;
-							}
-						} else {
-							if (runCommand(data, CMD_START_STREAM) != EXIT_SUCCESS) {
-								run = 0;
-							}
-						}
-					}
+			case 'z':
+				data->scale = atoi(optarg);
+				if (data->scale == 0) {
+					printf("Scale must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
 				break;
-				case SDLK_h:
-					data->showHelp=!data->showHelp;
+			case 'f':
+				data->fullscreenFlag = SDL_WINDOW_FULLSCREEN_DESKTOP;
+				printf("Fullscreen is on.\n");
 				break;
-				case SDLK_p:
-					data->stopStreamOnExit=0;
-					if (powerOff(data) != EXIT_SUCCESS) {
+			case 's':
+				data->renderFlag = SDL_RENDERER_SOFTWARE;
+				break;
+			case 'v':
+				data->vsyncFlag = SDL_RENDERER_PRESENTVSYNC;
+				printf("Vsync is on.\n");
+				break;
+			case 'V':
+				data->verbose=1;
+				printf("Verbose is on.\n");
+				break;
+			case 'c':
+				data->fast = 0;
+				break;
+			case 'm':
+				data->audioFlag=0;
+				printf("Audio is off.\n");
+				break;
+			case 'N':
+				data->headless = 1;
+				break;
+			case 'j':
+				data->audioLatency = atoi(optarg);
+				if (data->audioLatency <= 0) {
+					printf("Audio latency must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				data->audioSamples = atoi(optarg);
+				if (data->audioSamples <= 0 || data->audioSamples > 0xffff) {
+					printf("Audio buffer size must be an integer between 1 and 65535.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'R':
+				data->audioFrequency = atoi(optarg);
+				if (data->audioFrequency < RS_MIN_RATE || data->audioFrequency > RS_MAX_RATE) {
+					printf("Audio rate must be an integer between %i and %i.\n", RS_MIN_RATE, RS_MAX_RATE);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'B':
+				data->benchResampler = 1;
+				break;
+			case 'w':
+				data->rec.writeback = 1;
+				break;
+			case 't':
+				data->curColors = DCOLORS;
+				printf("Using DusteDs CRT colors.\n");
+				break;
+			case 'T':
+				if (strlen(optarg) != USER_COLORS) {
+					printf("Error: Expected a string of exactly %i characters (see  -T without parameter to see examples)\n", USER_COLORS);
+					return EXIT_FAILURE;
+				}
+				setUserColors(optarg);
+				data->curColors = UCOLORS;
+				break;
+			case 'o':
+				data->verbose=1;
+				printf("Turning on verbose mode, so you can see if you miss any data!\n");
+				printf("Outputting video to %s.rgb and audio to %s.pcm ...\n", optarg, optarg);
+				printf( "\nTry encoding with:\n"
+						"ffmpeg -vcodec rawvideo -pix_fmt abgr -s 384x272 -r 50\\\n"
+						"  -i %s.rgb -f s16le -ar 47983 -ac 2 -i %s.pcm\\\n"
+						"  -vf scale=w=1920:h=1080:force_original_aspect_ratio=decrease\\\n"
+						"  -sws_flags neighbor -crf 15 -vcodec libx264 %s.avi\n"
+						"Put -itsoffset with the audio_offset from %s.sync before the .pcm input to keep them in sync.\n"
+						"Or record with -M and encode the .mkv directly.\n\n",
+						optarg, optarg, optarg, optarg);
+
+				strncpy(data->recName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'O':
+				strncpy(data->nativeName, optarg, MAX_STRING_SIZE - 1);
+				printf("Recording packed frames and audio to %s.u64, expand it with -X %s for encoding.\n", optarg, optarg);
+				break;
+			case 'S':
+				strncpy(data->shots.name, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'n':
+				data->shots.count = atoi(optarg);
+				if(data->shots.count < 1 || data->shots.count > SHOT_MAX_BURST) {
+					printf("Burst length must be from 1 to %i frames.\n", SHOT_MAX_BURST);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'M':
+				strncpy(data->mkvName, optarg, MAX_STRING_SIZE - 1);
+				printf("Recording frames and audio to %s.mkv, timed and indexed for playing or encoding as it is.\n", optarg);
+				break;
+			case 'g':
+				data->rec.segSeconds = atof(optarg);
+				if(data->rec.segSeconds <= 0) {
+					printf("Segment length must be a number of seconds larger than 0.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'G':
+				data->rec.segBytes = (uint64_t)atoi(optarg) * 1024 * 1024;
+				if(data->rec.segBytes == 0) {
+					printf("Segment size must be an integer number of MiB larger than 0.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'k':
+				data->recordPaused = 1;
+				break;
+			case 'y':
+			case 'Y':
+				if(!strcmp(optarg, "-")) {
+#ifndef _WIN32
+					if(data->pipeStdout >= 0) {
+						printf("Only one of -y and -Y can write to stdout.\n");
+						return EXIT_FAILURE;
+					}
+					// Everything printed goes to stderr from here on, so stdout only carries the stream
+					fflush(stdout);
+					data->pipeStdout = dup(1);
+					dup2(2, 1);
+#endif
+				}
+				strncpy(c == 'y' ? data->pipeVideoName : data->pipeAudioName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'e':
+				if(!strcmp(optarg, "block")) {
+					data->pipeBlock = 1;
+				} else if(!strcmp(optarg, "drop")) {
+					data->pipeFrames = 1;
+				} else {
+					data->pipeFrames = atoi(optarg);
+					if(data->pipeFrames < 1 || data->pipeFrames > PIPE_MAX_FRAMES) {
+						printf("Pipe policy must be block, drop or a number of frames from 1 to %i.\n", PIPE_MAX_FRAMES);
+						return EXIT_FAILURE;
+					}
+				}
+				break;
+			case 'X':
+				strncpy(data->exportName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'x':
+				strncpy(data->transcodeName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'E':
+				strncpy(data->codecBenchName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'r':
+				strncpy(data->playName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'H':
+				data->history.seconds = atoi(optarg);
+				if (data->history.seconds <= 0) {
+					printf("Instant replay length must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'L':
+				strncpy(data->loadFile, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'd':
+				strncpy(data->dbgFile, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'D':
+				if (atoi(optarg) <= 0) {
+					printf("Debug capture size must be an integer larger than 0.\n");
+					return EXIT_FAILURE;
+				}
+				data->dbgCaptureSize = (uint64_t)atoi(optarg) * 1024 * 1024;
+				break;
+			case 'Q':
+				strncpy(data->dbgQuery, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'p':
+				strncpy(data->pktFile, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'P':
+				strncpy(data->replayFile, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'u':
+				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
+				break;
+			case 'U':
+				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
+				data->stopStreamOnExit=0;
+				break;
+			case 'I':
+				strncpy(data->hostName, optarg, MAX_STRING_SIZE - 1);
+				data->stopStreamOnExit=0;
+				data->startStreamOnStart=0;
+				break;
+			case '?':
+				if (optopt == 'l' || optopt == 'a' || optopt == 'z' ||
+				    optopt == 'u' || optopt  == 'U' || optopt == 'I' || optopt == 'L' ||
+				    optopt == 'd' || optopt == 'D' || optopt == 'Q' || optopt == 'j' ||
+				    optopt == 'b' || optopt == 'R' || optopt == 'O' || optopt == 'X' || optopt == 'x' || optopt == 'M' || optopt == 'g' || optopt == 'G' || optopt == 'y' || optopt == 'Y' || optopt == 'e' || optopt == 'S' || optopt == 'n' || optopt == 'E' || optopt == 'H' || optopt == 'r' ||
+				    optopt == 'p' || optopt == 'P') {
+					printf("Option -%c requires an argument.\n", optopt);
+					return EXIT_FAILURE;
+				} else if (optopt == 'T') {
+					printf("User-defined color option (-T):\n\n    Default colors: ");
+					printColors(sred, sgreen, sblue);
+					printf("\n    DusteDs colors: ");
+					printColors(dred, dgreen, dblue);
+					printf("\n\n    If you want to use your own color values, just type them after -T in the format shown above (RGB24 in hex, like HTML, and comma between each color).\n"
+							"    The colors are, in order: black, white, red, cyan, purple, green, blue, yellow, orange, brown, pink, dark-grey, grey, light-green, light-blue, light-grey.\n"
+							"    Example: DusteDs colors, with a slightly darker blue: -T 060a0b,f2f1f1,b63c47,a2f7ed,af45d7,86f964,0030Ef,f8fe8a,d06e28,794e00,fb918f,5e6e69,a3b6ad,d1fcc5,6eb3ff,dce2db\n\n\n");
+					return EXIT_FAILURE;
+				} else {
+					printf("Invalid argument '-%c'\n", optopt);
+				}
+				return EXIT_FAILURE;
+			case 'h':
+			/* fall through */
+			default:
+				printHelp();
+				return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static double besselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+
+	for(int k=1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Kaiser windowed sinc, t in input samples, cutoff relative to the input Nyquist frequency
+static double rsKernelAt(double t, double cutoff)
+{
+	double x = t / (RS_TAPS / 2);
+	double s = (fabs(t) < 1e-9) ? 1.0 : sin(M_PI * cutoff * t) / (M_PI * cutoff * t);
+
+	if(fabs(x) >= 1.0) {
+		return 0.0;
+	}
+	return cutoff * s * besselI0(RS_KAISER_BETA * sqrt(1.0 - x * x)) / besselI0(RS_KAISER_BETA);
+}
+
+static void rsDotScalar(const float *l, const float *r, const float *c0, const float *c1, float f, float *out)
+{
+	float sl = 0, sr = 0;
+
+	for(int k=0; k < RS_TAPS; k++) {
+		float c = c0[k] + (c1[k] - c0[k]) * f;
+		sl += l[k] * c;
+		sr += r[k] * c;
+	}
+	out[0] = sl;
+	out[1] = sr;
+}
+
+#if defined(__SSE__) || defined(_M_X64)
+static void rsDotSse(const float *l, const float *r, const float *c0, const float *c1, float f, float *out)
+{
+	__m128 vf = _mm_set1_ps(f);
+	__m128 sl = _mm_setzero_ps();
+	__m128 sr = _mm_setzero_ps();
+
+	for(int k=0; k < RS_TAPS; k += 4) {
+		__m128 a = _mm_loadu_ps(c0 + k);
+		__m128 c = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(c1 + k), a), vf));
+		sl = _mm_add_ps(sl, _mm_mul_ps(_mm_loadu_ps(l + k), c));
+		sr = _mm_add_ps(sr, _mm_mul_ps(_mm_loadu_ps(r + k), c));
+	}
+
+	// Horizontal sums of both channels in one go
+	__m128 lo = _mm_unpacklo_ps(sl, sr);
+	__m128 hi = _mm_unpackhi_ps(sl, sr);
+	__m128 s = _mm_add_ps(lo, hi);
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	_mm_storel_pi((__m64*)out, s);
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("avx,fma")))
+static void rsDotAvx(const float *l, const float *r, const float *c0, const float *c1, float f, float *out)
+{
+	__m256 vf = _mm256_set1_ps(f);
+	__m256 sl = _mm256_setzero_ps();
+	__m256 sr = _mm256_setzero_ps();
+
+	for(int k=0; k < RS_TAPS; k += 8) {
+		__m256 a = _mm256_loadu_ps(c0 + k);
+		__m256 c = _mm256_fmadd_ps(_mm256_sub_ps(_mm256_loadu_ps(c1 + k), a), vf, a);
+		sl = _mm256_fmadd_ps(_mm256_loadu_ps(l + k), c, sl);
+		sr = _mm256_fmadd_ps(_mm256_loadu_ps(r + k), c, sr);
+	}
+
+	__m128 l4 = _mm_add_ps(_mm256_castps256_ps128(sl), _mm256_extractf128_ps(sl, 1));
+	__m128 r4 = _mm_add_ps(_mm256_castps256_ps128(sr), _mm256_extractf128_ps(sr, 1));
+	__m128 s = _mm_add_ps(_mm_unpacklo_ps(l4, r4), _mm_unpackhi_ps(l4, r4));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	_mm_storel_pi((__m64*)out, s);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void rsDotNeon(const float *l, const float *r, const float *c0, const float *c1, float f, float *out)
+{
+	float32x4_t sl = vdupq_n_f32(0);
+	float32x4_t sr = vdupq_n_f32(0);
+
+	for(int k=0; k < RS_TAPS; k += 4) {
+		float32x4_t a = vld1q_f32(c0 + k);
+		float32x4_t c = vmlaq_n_f32(a, vsubq_f32(vld1q_f32(c1 + k), a), f);
+		sl = vmlaq_f32(sl, vld1q_f32(l + k), c);
+		sr = vmlaq_f32(sr, vld1q_f32(r + k), c);
+	}
+	float32x2_t s = vpadd_f32(vpadd_f32(vget_low_f32(sl), vget_high_f32(sl)), vpadd_f32(vget_low_f32(sr), vget_high_f32(sr)));
+	vst1_f32(out, s);
+}
+#endif
+
+// Pick the widest kernel the cpu can run, or the one asked for by name
+static int rsSelectKernel(resampler_t *rs, const char *name)
+{
+	const struct {
+		const char *name;
+		rsDot dot;
+		int available;
+	} kernels[] = {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		// The kernel uses FMA, which came separately from AVX2 on some cpus and can be turned off in VMs
+		{ "avx", rsDotAvx, SDL_HasAVX2() && __builtin_cpu_supports("fma") },
+#endif
+#if defined(__SSE__) || defined(_M_X64)
+		{ "sse", rsDotSse, 1 },
+#endif
+#if defined(__ARM_NEON)
+		{ "neon", rsDotNeon, 1 },
+#endif
+		{ "scalar", rsDotScalar, 1 },
+	};
+
+	for(int i=0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if(kernels[i].available && (!name || !strcmp(name, kernels[i].name))) {
+			rs->dot = kernels[i].dot;
+			rs->kernelName = kernels[i].name;
+			return EXIT_SUCCESS;
+		}
+	}
+	return EXIT_FAILURE;
+}
+
+// Build the filter table for converting inRate to outRate, drift corrections are small enough to not need a new one
+int rsInit(resampler_t *rs, double inRate, double outRate)
+{
+	double cutoff = RS_ROLLOFF * ((outRate < inRate) ? outRate / inRate : 1.0);
+
+	memset(rs, 0, sizeof(resampler_t));
+	rs->cutoff = cutoff;
+	rs->coeffs = malloc((RS_PHASES + 1) * RS_TAPS * sizeof(float));
+	if(!rs->coeffs) {
+		return EXIT_FAILURE;
+	}
+
+	// Row p holds the taps for an output p/RS_PHASES of the way past input sample RS_TAPS/2-1 of the window
+	for(int p=0; p <= RS_PHASES; p++) {
+		double sum = 0;
+		for(int k=0; k < RS_TAPS; k++) {
+			sum += rsKernelAt((double)p / RS_PHASES + RS_TAPS / 2 - 1 - k, cutoff);
+		}
+		for(int k=0; k < RS_TAPS; k++) {
+			rs->coeffs[p * RS_TAPS + k] = rsKernelAt((double)p / RS_PHASES + RS_TAPS / 2 - 1 - k, cutoff) / sum;
+		}
+	}
+
+	// Start with half a window of silence, so the first output is at the first input sample
+	rs->avail = RS_TAPS / 2 - 1;
+	rs->pos = RS_TAPS / 2 - 1;
+	rsSelectKernel(rs, NULL);
+
+	return EXIT_SUCCESS;
+}
+
+void rsFree(resampler_t *rs)
+{
+	free(rs->coeffs);
+	rs->coeffs = NULL;
+}
+
+// Band-limited resampling of interleaved S16, step is input frames per output frame and may change between calls.
+// Returns the number of output frames.
+int rsProcess(resampler_t *rs, const int16_t *in, int frames, int16_t *out, int maxOut, double step)
+{
+	int n = 0;
+	float o[AUDIO_CHANNELS];
+
+	// Only happens when the output can't keep up with the input, which the rate limits rule out
+	if(unlikely(frames > RS_HIST - rs->avail)) {
+		frames = RS_HIST - rs->avail;
+	}
+	for(int i=0; i < frames; i++) {
+		rs->hist[0][rs->avail + i] = in[i * AUDIO_CHANNELS];
+		rs->hist[1][rs->avail + i] = in[i * AUDIO_CHANNELS + 1];
+	}
+	rs->avail += frames;
+
+	while(n < maxOut && (int)rs->pos + RS_TAPS / 2 < rs->avail) {
+		int i = (int)rs->pos;
+		double fp = (rs->pos - i) * RS_PHASES;
+		int ph = (int)fp;
+		const float *c0 = rs->coeffs + ph * RS_TAPS;
+		int first = i - RS_TAPS / 2 + 1;
+
+		rs->dot(&rs->hist[0][first], &rs->hist[1][first], c0, c0 + RS_TAPS, (float)(fp - ph), o);
+
+		for(int c=0; c < AUDIO_CHANNELS; c++) {
+			float v = o[c] + ((o[c] >= 0) ? 0.5f : -0.5f);
+			out[n * AUDIO_CHANNELS + c] = (v > 32767.0f) ? 32767 : (v < -32768.0f) ? -32768 : (int16_t)v;
+		}
+		n++;
+		rs->pos += step;
+	}
+
+	// Keep the window needed for the next output
+	int drop = (int)rs->pos - RS_TAPS / 2 + 1;
+	if(drop > rs->avail) {
+		drop = rs->avail;
+	}
+	if(drop > 0) {
+		memmove(rs->hist[0], rs->hist[0] + drop, (rs->avail - drop) * sizeof(float));
+		memmove(rs->hist[1], rs->hist[1] + drop, (rs->avail - drop) * sizeof(float));
+		rs->avail -= drop;
+		rs->pos -= drop;
+	}
+
+	return n;
+}
+
+// Evaluate the filter exactly at output n, in double precision. This is what the table version should come close to.
+static int rsReference(const int16_t *in, int frames, int n, double step, double cutoff, double *out)
+{
+	double pos = n * step;
+	int i = (int)pos;
+	double f = pos - i;
+	double norm = 0;
+
+	if(i - RS_TAPS / 2 + 1 < 0 || i + RS_TAPS / 2 >= frames) {
+		return 0;
+	}
+
+	out[0] = out[1] = 0;
+	for(int k=0; k < RS_TAPS; k++) {
+		double c = rsKernelAt(f + RS_TAPS / 2 - 1 - k, cutoff);
+		int idx = i - RS_TAPS / 2 + 1 + k;
+		out[0] += in[idx * AUDIO_CHANNELS] * c;
+		out[1] += in[idx * AUDIO_CHANNELS + 1] * c;
+		norm += c;
+	}
+	out[0] /= norm;
+	out[1] /= norm;
+
+	return 1;
+}
+
+// Microbenchmark and accuracy check of the resampler kernels against the reference, for each common device rate
+int resamplerBench(void)
+{
+	const int rates[] = { 44100, 48000, 96000 };
+	const char *names[] = { "scalar", "sse", "avx", "neon" };
+	int frames = U64_AUDIO_FREQUENCY * RS_BENCH_SECONDS;
+	int16_t *in = malloc(frames * AUDIO_FRAME_SIZE);
+	int16_t *out = malloc(frames * 2 * AUDIO_FRAME_SIZE + JITTER_MAX_FRAMES * AUDIO_FRAME_SIZE);
+	resampler_t rs;
+	int result = EXIT_SUCCESS;
+
+	if(!in || !out) {
+		printf("Error: Out of memory.\n");
+		free(in);
+		free(out);
+		return EXIT_FAILURE;
+	}
+
+	// A few tones below the lowest output Nyquist frequency, like a SID would make
+	for(int i=0; i < frames; i++) {
+		double t = (double)i / U64_AUDIO_FREQUENCY;
+		in[i * AUDIO_CHANNELS] = 9000 * sin(2 * M_PI * 440 * t) + 6000 * sin(2 * M_PI * 3520 * t) + 3000 * sin(2 * M_PI * 15000 * t);
+		in[i * AUDIO_CHANNELS + 1] = 12000 * sin(2 * M_PI * 1000 * t) + 4000 * sin(2 * M_PI * 9000 * t);
+	}
+
+	printf("Resampling %i s of stereo from %i Hz.\n", RS_BENCH_SECONDS, U64_AUDIO_FREQUENCY);
+	for(int r=0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		double step = (double)U64_AUDIO_FREQUENCY / rates[r];
+
+		for(int k=0; k < sizeof(names) / sizeof(names[0]); k++) {
+			if(rsInit(&rs, U64_AUDIO_FREQUENCY, rates[r]) != EXIT_SUCCESS || rsSelectKernel(&rs, names[k]) != EXIT_SUCCESS) {
+				rsFree(&rs);
+				continue;
+			}
+
+			int n = 0;
+			uint64_t start = SDL_GetPerformanceCounter();
+			for(int i=0; i < frames; i += AUDIO_SAMPLES) {
+				int len = (frames - i < AUDIO_SAMPLES) ? frames - i : AUDIO_SAMPLES;
+				n += rsProcess(&rs, in + i * AUDIO_CHANNELS, len, out + n * AUDIO_CHANNELS, JITTER_MAX_FRAMES, step);
+			}
+			double sec = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+			double sig = 0, err = 0;
+			int compared = 0;
+			for(int i=0; i < n; i += RS_BENCH_COMPARE_STEP) {
+				double ref[AUDIO_CHANNELS];
+				if(!rsReference(in, frames, i, step, rs.cutoff, ref)) {
+					continue;
+				}
+				for(int c=0; c < AUDIO_CHANNELS; c++) {
+					double d = out[i * AUDIO_CHANNELS + c] - ref[c];
+					sig += ref[c] * ref[c];
+					err += d * d;
+				}
+				compared++;
+			}
+			double snr = (err > 0) ? 10 * log10(sig / err) : 999;
+
+			printf("  %6i Hz %-6s: %8.1f Mframes/s (%6.0fx realtime), SNR vs reference %5.1f dB over %i frames.\n",
+				rates[r], rs.kernelName, n / sec / 1e6, RS_BENCH_SECONDS / sec, snr, compared);
+			if(snr < RS_MIN_SNR) {
+				printf("  Error: %s kernel is not accurate enough, expected at least %i dB.\n", rs.kernelName, RS_MIN_SNR);
+				result = EXIT_FAILURE;
+			}
+			rsFree(&rs);
+		}
+	}
+
+	free(in);
+	free(out);
+
+	return result;
+}
+
+static inline int ringFill(audioRing_t *ring)
+{
+	return (uint32_t)SDL_AtomicGet(&ring->writePos) - (uint32_t)SDL_AtomicGet(&ring->readPos);
+}
+
+// Only ever called from the network side, frames that don't fit are dropped. NULL writes silence.
+static int ringWrite(audioRing_t *ring, const int16_t *frames, int n)
+{
+	uint32_t w = SDL_AtomicGet(&ring->writePos);
+	int space = AUDIO_RING_FRAMES - ringFill(ring);
+
+	if(unlikely(n > space)) {
+		n = space;
+	}
+
+	for(int i=0; i < n; i++) {
+		int16_t *dst = &ring->buf[((w + i) & (AUDIO_RING_FRAMES - 1)) * AUDIO_CHANNELS];
+		for(int c=0; c < AUDIO_CHANNELS; c++) {
+			dst[c] = frames ? frames[i * AUDIO_CHANNELS + c] : 0;
+		}
+	}
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&ring->writePos, w + n);
+	SDL_AtomicSet(&ring->starved, 0);
+
+	return n;
+}
+
+// Runs on the SDL audio thread, pulls whatever the network side has put in the ring without taking any locks
+static void SDLCALL audioCallback(void *userdata, Uint8 *stream, int len)
+{
+	audioRing_t *ring = (audioRing_t*)userdata;
+	int16_t *out = (int16_t*)stream;
+	int want = len / AUDIO_FRAME_SIZE;
+	uint32_t r = SDL_AtomicGet(&ring->readPos);
+	int n = ringFill(ring);
+
+	SDL_MemoryBarrierAcquire();
+	if(n > want) {
+		n = want;
+	}
+
+	for(int i=0; i < n; i++) {
+		const int16_t *src = &ring->buf[((r + i) & (AUDIO_RING_FRAMES - 1)) * AUDIO_CHANNELS];
+		for(int c=0; c < AUDIO_CHANNELS; c++) {
+			out[i * AUDIO_CHANNELS + c] = src[c];
+		}
+	}
+	SDL_AtomicSet(&ring->readPos, r + n);
+
+	if(unlikely(n < want)) {
+		memset(out + n * AUDIO_CHANNELS, 0, (want - n) * AUDIO_FRAME_SIZE);
+		// Count each time we run dry, not every callback while the stream is gone
+		if(SDL_AtomicGet(&ring->primed) && SDL_AtomicCAS(&ring->starved, 0, 1)) {
+			SDL_AtomicAdd(&ring->underruns, 1);
+		}
+	}
+}
+
+// Keep the ring at the target latency by resampling slightly faster or slower, that way the difference between the
+// U64 clock and the sound card clock is soaked up instead of the queue growing or running dry.
+void queueAudio(programData *data, const void *sample)
+{
+	jitterBuffer_t *jb = &data->jb;
+	audioRing_t *ring = &data->ring;
+	int queued = ringFill(ring);
+
+	if(unlikely(queued == 0)) {
+		// Started, or ran dry, rebuild the cushion with silence so we don't underrun again on the next packet
+		SDL_AtomicSet(&ring->primed, 1);
+		queued = ringWrite(ring, NULL, jb->targetFrames - AUDIO_SAMPLES);
+		jb->avgFrames = jb->targetFrames;
+	} else if(unlikely(queued > jb->targetFrames * JITTER_OVERRUN_FACTOR)) {
+		// Way behind, drop packets until the callback has caught up
+		jb->overruns++;
+		return;
+	}
+
+	jb->avgFrames += (queued - jb->avgFrames) * JITTER_AVERAGE;
+	double err = (jb->avgFrames - jb->targetFrames) / jb->targetFrames;
+	jb->integral += err * JITTER_KI;
+	if(jb->integral > JITTER_MAX_CORRECTION) {
+		jb->integral = JITTER_MAX_CORRECTION;
+	} else if(jb->integral < -JITTER_MAX_CORRECTION) {
+		jb->integral = -JITTER_MAX_CORRECTION;
+	}
+	jb->correction = jb->integral + err * JITTER_KP;
+	if(jb->correction > JITTER_MAX_CORRECTION) {
+		jb->correction = JITTER_MAX_CORRECTION;
+	} else if(jb->correction < -JITTER_MAX_CORRECTION) {
+		jb->correction = -JITTER_MAX_CORRECTION;
+	}
+	jb->step = ((double)U64_AUDIO_FREQUENCY / data->have.freq) * (1.0 + jb->correction);
+
+	int frames = rsProcess(&jb->rs, sample, AUDIO_SAMPLES, jb->out, JITTER_MAX_FRAMES, jb->step);
+	if(unlikely(ringWrite(ring, jb->out, frames) < frames)) {
+		jb->overruns++;
+	}
+}
+
+static inline double clockNow(void)
+{
+	return (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+}
+
+// Track how a stream's own timeline (frames, audio packets) maps to our clock. The least delayed packets tell us that,
+// the estimate is allowed to creep up slowly so it follows clock drift and route changes.
+static void clockUpdate(clockTrack_t *t, double now, uint64_t unit)
+{
+	double o = now - unit * t->period;
+
+	if(unlikely(!t->started || o < t->offset)) {
+		t->offset = o;
+		t->started = 1;
+	} else {
+		t->offset += (now - t->lastUpdate) * CLOCK_RISE;
+	}
+	t->lastUpdate = now;
+}
+
+static inline double clockTime(const clockTrack_t *t, uint64_t unit)
+{
+	return t->offset + unit * t->period;
+}
+
+// How far behind the stream clock the sample coming out of the speakers is
+static double audioLatency(programData *data)
+{
+	streamClock_t *sc = &data->clock;
+	double queued = (ringFill(&data->ring) + data->have.samples) / (double)data->have.freq;
+
+	return clockNow() - (clockTime(&sc->audio, sc->audioBlocks) - queued);
+}
+
+// Two pixels per byte in, two pixels per uint64 out, pitch is in uint64s
+static void expandPacked(const uint8_t *packed, const uint64_t *pixMap, void *pixels, int width, int height, int pitch)
+{
+	int hw = width / 2;
+	for(int y=0; y < height; y++) {
+		uint64_t *dst = (uint64_t*)pixels + y * pitch;
+		const uint8_t *src = packed + y * hw;
+		for(int x=0; x < hw; x++) {
+			dst[x] = pixMap[src[x]];
+		}
+	}
+}
+
+static inline void expandFrame(programData *data, const uint8_t *packed)
+{
+	expandPacked(packed, data->pixMap, data->pixels, data->width, data->height, data->pitch / 8);
+}
+
+// Copy the lines of a video packet into the frame being assembled
+static inline void storeVideoPacket(programData *data, const u64msg_t *p)
+{
+	int hw = data->width / 2;
+	int y = p->line & 0b0111111111111111;
+	int lpp = p->linexInPacket;
+	int hppl = p->pixelsInLine / 2;
+
+	if(unlikely(hppl > hw)) {
+		hppl = hw;
+	}
+	for(int l=0; l < lpp && y + l < data->height; l++) {
+		memcpy(data->packed + (y + l) * hw, p->payload + l * hppl, hppl);
+	}
+}
+
+// Seconds until the next queued frame is due, or -1 if there is none
+static double nextFrameDue(programData *data, double now)
+{
+	streamClock_t *sc = &data->clock;
+
+	if(!sc->queued) {
+		return -1;
+	}
+	return (sc->due[sc->head] > now) ? sc->due[sc->head] - now : 0;
+}
+
+void showAvOffset(programData *data)
+{
+	char title[MAX_STRING_SIZE];
+
+	if(data->timeShift.active) {
+		history_t *h = &data->history;
+		snprintf(title, sizeof(title), "Ultimate 64 view! (%s, %.2f s behind live)", data->timeShift.paused ? "paused" : "time-shifted",
+			(h->frameCount - 1 - data->timeShift.frame) * data->clock.video.period);
+	} else {
+		snprintf(title, sizeof(title), "Ultimate 64 view! (A/V %+.1f ms%s)", data->clock.offset * 1000.0,
+			(data->rec.thread && SDL_AtomicGet(&data->rec.active)) ? ", recording" : "");
+	}
+	SDL_SetWindowTitle(data->win, title);
+	if(data->verbose) {
+		printf("A/V offset %+.1f ms, video delayed %.1f ms.\n", data->clock.offset * 1000.0, data->clock.delay * 1000.0);
+	}
+}
+
+// Tell how far the recorded audio and video starts are apart, so they can be lined up when muxing
+static void writeSyncFile(const char *name, double framePeriod, double videoStart, double audioStart)
+{
+	char fn[MAX_STRING_SIZE + 32];
+	FILE *fp;
+
+	// Also called from the recorder thread, so not in fnbuf
+	if(snprintf(fn, sizeof(fn), "%s.sync", name) >= (int)sizeof(fn)) {
+		printf("Error: File name %s.sync is too long.\n", name);
+		return;
+	}
+	fp = fopen(fn, "w");
+	if(!fp) {
+		printf("Error opening %s for writing.\n", fn);
+		return;
+	}
+
+	double offset = audioStart - videoStart;
+	fprintf(fp, "video_frame_period=%.9f\naudio_sample_rate=%i\nvideo_start=%.6f\naudio_start=%.6f\naudio_offset=%.6f\n",
+		framePeriod, U64_AUDIO_FREQUENCY, videoStart, audioStart, offset);
+	fclose(fp);
+
+	printf("Audio starts %.1f ms after video in the recording, mux with -itsoffset %.6f before -i %s.pcm (written to %s).\n",
+		offset * 1000.0, offset, name, fn);
+}
+
+static inline recBuf_t *recPop(recQueue_t *q)
+{
+	uint32_t r = SDL_AtomicGet(&q->readPos);
+
+	if(r == (uint32_t)SDL_AtomicGet(&q->writePos)) {
+		return NULL;
+	}
+	SDL_MemoryBarrierAcquire();
+	recBuf_t *b = q->buf[r & (REC_QUEUE_SIZE - 1)];
+	SDL_AtomicSet(&q->readPos, r + 1);
+	return b;
+}
+
+static inline void recPush(recQueue_t *q, recBuf_t *b)
+{
+	uint32_t w = SDL_AtomicGet(&q->writePos);
+
+	q->buf[w & (REC_QUEUE_SIZE - 1)] = b;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&q->writePos, w + 1);
+}
+
+// Frame codec for native recordings. Each frame is XORed with the one before, so what didn't change is zero,
+// the zero runs become one symbol each and the rest is Huffman coded with a table made for that frame.
+// Run symbol k stands for 2^k to 2^(k+1)-1 zeros, followed by k extra bits.
+static inline int codecRunSymbol(uint32_t run)
+{
+	int k = 0;
+	while(run >> (k + 1)) {
+		k++;
+	}
+	return k;
+}
+
+// Huffman code lengths limited to CODEC_MAX_BITS, by flattening the counts until the tree is shallow enough
+static void codecBuildLengths(const uint32_t *freq, uint8_t *lengths)
+{
+	uint32_t f[CODEC_SYMBOLS];
+	uint32_t weight[2 * CODEC_SYMBOLS];
+	uint16_t sym[CODEC_SYMBOLS];
+	uint16_t parent[2 * CODEC_SYMBOLS];
+	uint8_t depth[2 * CODEC_SYMBOLS];
+
+	memcpy(f, freq, sizeof(f));
+	memset(lengths, 0, CODEC_SYMBOLS);
+
+	for(;;) {
+		int n = 0;
+		for(int i=0; i < CODEC_SYMBOLS; i++) {
+			if(f[i]) {
+				// Insertion sort by count, there are only a few hundred
+				int j = n++;
+				while(j > 0 && f[sym[j - 1]] > f[i]) {
+					sym[j] = sym[j - 1];
+					j--;
+				}
+				sym[j] = i;
+			}
+		}
+		if(n == 0) {
+			return;
+		}
+		if(n == 1) {
+			lengths[sym[0]] = 1;
+			return;
+		}
+
+		// Two queues, the sorted leaves and the internal nodes in the order they were made
+		for(int i=0; i < n; i++) {
+			weight[i] = f[sym[i]];
+		}
+		int leaf = 0, node = n, next = n;
+		for(int k=0; k < n - 1; k++) {
+			int pick[2];
+			for(int m=0; m < 2; m++) {
+				if(leaf < n && (node == next || weight[leaf] <= weight[node])) {
+					pick[m] = leaf++;
+				} else {
+					pick[m] = node++;
+				}
+			}
+			weight[next] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = next;
+			next++;
+		}
+
+		// Parents always come after their children, so walk down from the root
+		int maxDepth = 0;
+		depth[next - 1] = 0;
+		for(int i=next - 2; i >= 0; i--) {
+			depth[i] = depth[parent[i]] + 1;
+			if(i < n && depth[i] > maxDepth) {
+				maxDepth = depth[i];
+			}
+		}
+
+		if(maxDepth <= CODEC_MAX_BITS) {
+			for(int i=0; i < n; i++) {
+				lengths[sym[i]] = depth[i];
+			}
+			return;
+		}
+		for(int i=0; i < CODEC_SYMBOLS; i++) {
+			if(f[i]) {
+				f[i] = (f[i] >> 1) | 1;
+			}
+		}
+	}
+}
+
+// Canonical codes, bit reversed since the stream is read from the low bit up
+static void codecBuildCodes(const uint8_t *lengths, uint16_t *codes)
+{
+	int count[CODEC_MAX_BITS + 1] = { 0 };
+	int next[CODEC_MAX_BITS + 1];
+	int code = 0;
+
+	for(int i=0; i < CODEC_SYMBOLS; i++) {
+		count[lengths[i]]++;
+	}
+	count[0] = 0;
+	for(int b=1; b <= CODEC_MAX_BITS; b++) {
+		code = (code + count[b - 1]) << 1;
+		next[b] = code;
+	}
+
+	for(int i=0; i < CODEC_SYMBOLS; i++) {
+		int len = lengths[i];
+		uint16_t rev = 0;
+		if(!len) {
+			continue;
+		}
+		code = next[len]++;
+		for(int b=0; b < len; b++) {
+			rev |= ((code >> b) & 1) << (len - 1 - b);
+		}
+		codes[i] = rev;
+	}
+}
+
+static inline void codecPutBits(bitWriter_t *w, uint32_t value, int bits)
+{
+	w->acc |= (uint64_t)value << w->bits;
+	w->bits += bits;
+	while(w->bits >= 8) {
+		if(likely(w->pos < w->size)) {
+			w->out[w->pos] = (uint8_t)w->acc;
+		}
+		w->pos++;
+		w->acc >>= 8;
+		w->bits -= 8;
+	}
+}
+
+int codecInit(frameCodec_t *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->prev = calloc(1, PACKED_FRAME_SIZE);
+	c->tokens = malloc(PACKED_FRAME_SIZE * sizeof(uint32_t));
+	if(!c->prev || !c->tokens) {
+		free(c->prev);
+		free(c->tokens);
+		c->prev = NULL;
+		c->tokens = NULL;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+void codecFree(frameCodec_t *c)
+{
+	free(c->prev);
+	free(c->tokens);
+	c->prev = NULL;
+	c->tokens = NULL;
+}
+
+// Returns the coded size, or 0 when it would not be smaller than the frame itself, store it raw then.
+// A keyframe doesn't depend on the frame before. Either way the frame becomes the reference for the next one.
+size_t codecEncode(frameCodec_t *c, const uint8_t *frame, int key, uint8_t *out)
+{
+	uint32_t freq[CODEC_SYMBOLS];
+	uint8_t lengths[CODEC_SYMBOLS];
+	uint16_t codes[CODEC_SYMBOLS];
+	uint32_t *tok = c->tokens;
+	int n = 0;
+	bitWriter_t w = { out, 0, PACKED_FRAME_SIZE, 0, 0 };
+
+	if(key) {
+		memset(c->prev, 0, PACKED_FRAME_SIZE);
+	}
+
+	// Tokens are the symbol in the low 16 bits and the run length above
+	memset(freq, 0, sizeof(freq));
+	for(int i=0; i < PACKED_FRAME_SIZE;) {
+		uint8_t d = frame[i] ^ c->prev[i];
+		if(d) {
+			tok[n++] = d;
+			freq[d]++;
+			i++;
+		} else {
+			uint32_t run = 1;
+			while(i + run < PACKED_FRAME_SIZE && frame[i + run] == c->prev[i + run]) {
+				run++;
+			}
+			int s = CODEC_RUN_BASE + codecRunSymbol(run);
+			tok[n++] = s | run << 16;
+			freq[s]++;
+			i += run;
+		}
+	}
+	memcpy(c->prev, frame, PACKED_FRAME_SIZE);
+
+	codecBuildLengths(freq, lengths);
+	codecBuildCodes(lengths, codes);
+
+	for(int i=0; i < CODEC_SYMBOLS; i += 2) {
+		codecPutBits(&w, lengths[i] | (i + 1 < CODEC_SYMBOLS ? lengths[i + 1] : 0) << 4, 8);
+	}
+	for(int i=0; i < n; i++) {
+		int s = tok[i] & 0xffff;
+		codecPutBits(&w, codes[s], lengths[s]);
+		if(s >= CODEC_RUN_BASE) {
+			int k = s - CODEC_RUN_BASE;
+			codecPutBits(&w, (tok[i] >> 16) - (1 << k), k);
+		}
+	}
+	codecPutBits(&w, 0, 7);
+
+	return (w.pos < PACKED_FRAME_SIZE) ? w.pos : 0;
+}
+
+// Applies a coded frame on top of the previous one in frame, or on an empty one for keyframes
+int codecDecode(const uint8_t *in, size_t len, int key, uint8_t *frame)
+{
+	uint8_t lengths[CODEC_SYMBOLS];
+	uint16_t codes[CODEC_SYMBOLS];
+	uint16_t table[CODEC_TABLE_SIZE];
+	uint64_t acc = 0;
+	int bits = 0;
+	size_t pos = CODEC_HEADER_SIZE;
+
+	if(len < CODEC_HEADER_SIZE) {
+		return EXIT_FAILURE;
+	}
+	for(int i=0; i < CODEC_SYMBOLS; i++) {
+		lengths[i] = (in[i / 2] >> ((i & 1) * 4)) & 0x0f;
+		if(lengths[i] > CODEC_MAX_BITS) {
+			return EXIT_FAILURE;
+		}
+	}
+	codecBuildCodes(lengths, codes);
+
+	// Every entry is the symbol and its length for all the bit patterns that start with its code
+	memset(table, 0, sizeof(table));
+	for(int i=0; i < CODEC_SYMBOLS; i++) {
+		for(int fill = codes[i]; lengths[i] && fill < CODEC_TABLE_SIZE; fill += 1 << lengths[i]) {
+			table[fill] = i << 4 | lengths[i];
+		}
+	}
+
+	if(key) {
+		memset(frame, 0, PACKED_FRAME_SIZE);
+	}
+
+	for(int i=0; i < PACKED_FRAME_SIZE;) {
+		while(bits <= 56) {
+			if(likely(pos < len)) {
+				acc |= (uint64_t)in[pos] << bits;
+			}
+			pos++;
+			bits += 8;
+		}
+		uint16_t e = table[acc & (CODEC_TABLE_SIZE - 1)];
+		int l = e & 0x0f;
+		int s = e >> 4;
+		if(unlikely(!l)) {
+			return EXIT_FAILURE;
+		}
+		acc >>= l;
+		bits -= l;
+
+		if(s < CODEC_RUN_BASE) {
+			frame[i++] ^= s;
+		} else {
+			int k = s - CODEC_RUN_BASE;
+			uint32_t run = (1 << k) + (uint32_t)(acc & ((1 << k) - 1));
+			acc >>= k;
+			bits -= k;
+			if(unlikely(i + run > PACKED_FRAME_SIZE)) {
+				return EXIT_FAILURE;
+			}
+			i += run;
+		}
+	}
+
+	return (pos - bits / 8 <= len) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static size_t writeNativeChunk(FILE *fp, nativeChunkType type, uint64_t seq, double time, const void *payload, uint32_t size)
+{
+	nativeChunk_t c = { type, size, seq, time };
+
+	if(fwrite(&c, sizeof(c), 1, fp) != 1) {
+		return 0;
+	}
+	return size ? fwrite(payload, size, 1, fp) : 1;
+}
+
+int nativeWriterInit(nativeWriter_t *w, FILE *fp)
+{
+	memset(w, 0, sizeof(*w));
+	w->fp = fp;
+	w->coded = malloc(PACKED_FRAME_SIZE);
+	if(!w->coded || codecInit(&w->codec) != EXIT_SUCCESS) {
+		free(w->coded);
+		w->coded = NULL;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+void nativeWriterFree(nativeWriter_t *w)
+{
+	free(w->coded);
+	w->coded = NULL;
+	codecFree(&w->codec);
+}
+
+// The low half of the first 16 entries are the colors themselves
+static inline void pixMapPalette(const uint64_t *pixMap, uint32_t *palette)
+{
+	for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+		palette[i] = (uint32_t)pixMap[i];
+	}
+}
+
+static inline void paletteToPixMap(const uint32_t *palette, uint64_t *pixMap)
+{
+	for(int i=0; i < PIXMAP_SIZE; i++) {
+		pixMap[i] = (uint64_t)palette[i >> 4] << 32 | palette[i & 0x0f];
+	}
+}
+
+// Written at the start and again at the end, when the frame period and counts are known
+static void writeNativeHeader(nativeWriter_t *w, programData *data)
+{
+	nativeHeader_t h;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, NATIVE_MAGIC, sizeof(h.magic));
+	h.version = NATIVE_VERSION;
+	h.width = data->width;
+	h.height = data->height;
+	h.framePeriod = data->clock.video.period;
+	h.audioRate = U64_AUDIO_FREQUENCY;
+	h.audioBlockSize = SAMPLE_SIZE;
+	h.frames = w->frames;
+	h.audioBlocks = w->blocks;
+
+	if(fseek(w->fp, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w->fp) != 1) {
+		printf("Error writing native recording header.\n");
+	}
+	fseek(w->fp, 0, SEEK_END);
+}
+
+static size_t writeNativeFrame(nativeWriter_t *w, const uint8_t *frame, const uint32_t *palette, uint64_t seq, double time)
+{
+	if(unlikely(w->frames == 0 || memcmp(palette, w->palette, sizeof(w->palette)))) {
+		memcpy(w->palette, palette, sizeof(w->palette));
+		if(!writeNativeChunk(w->fp, NATIVE_PALETTE, seq, time, palette, sizeof(w->palette))) {
+			return 0;
+		}
+	}
+
+	// A frame the same as the one before, which the coder still has, is only a marker, so still screens take next to nothing.
+	// Keyframes wait for the next frame that changes.
+	if(w->frames && !memcmp(frame, w->codec.prev, PACKED_FRAME_SIZE)) {
+		w->frames++;
+		w->repeats++;
+		w->sinceKey++;
+		return writeNativeChunk(w->fp, NATIVE_VIDEO_REPEAT, seq, time, NULL, 0);
+	}
+
+	// Frames that don't compress are stored as they are, they also count as keyframes
+	int key = (w->frames == 0 || ++w->sinceKey >= NATIVE_KEYFRAME_INTERVAL);
+	size_t size = codecEncode(&w->codec, frame, key, w->coded);
+	w->frames++;
+	if(key) {
+		w->sinceKey = 0;
+	}
+	if(!size) {
+		w->bytes += PACKED_FRAME_SIZE;
+		return writeNativeChunk(w->fp, NATIVE_VIDEO, seq, time, frame, PACKED_FRAME_SIZE);
+	}
+	w->bytes += size;
+	return writeNativeChunk(w->fp, key ? NATIVE_VIDEO_KEY : NATIVE_VIDEO_DELTA, seq, time, w->coded, size);
+}
+
+static inline size_t writeNativeAudio(nativeWriter_t *w, const void *block, uint64_t seq, double time)
+{
+	w->blocks++;
+	return writeNativeChunk(w->fp, NATIVE_AUDIO, seq, time, block, SAMPLE_SIZE);
+}
+
+int decodeNativeFrame(uint32_t type, const uint8_t *payload, uint32_t size, uint8_t *frame)
+{
+	switch(type) {
+		case NATIVE_VIDEO:
+			if(size != PACKED_FRAME_SIZE) {
+				return EXIT_FAILURE;
+			}
+			memcpy(frame, payload, PACKED_FRAME_SIZE);
+			return EXIT_SUCCESS;
+		case NATIVE_VIDEO_KEY:
+			return codecDecode(payload, size, 1, frame);
+		case NATIVE_VIDEO_DELTA:
+			return codecDecode(payload, size, 0, frame);
+		case NATIVE_VIDEO_REPEAT:
+			return (size == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	return EXIT_FAILURE;
+}
+
+// Matroska, the frames as 4 bit BI_RGB in a VFW track with the colors in the codec private data, and the audio as PCM
+static void ebmlId(ebml_t *e, uint32_t id)
+{
+	int s = 24;
+
+	// The length of an ID is in its first byte
+	while(s > 0 && !(id >> s)) {
+		s -= 8;
+	}
+	for(; s >= 0; s -= 8) {
+		e->p[e->pos++] = (uint8_t)(id >> s);
+	}
+}
+
+static void ebmlBig(ebml_t *e, uint64_t v, int len)
+{
+	for(int i=len - 1; i >= 0; i--) {
+		e->p[e->pos++] = (uint8_t)(v >> (i * 8));
+	}
+}
+
+// Sizes written as 8 bytes can be filled in later without moving anything
+static void ebmlSize8(ebml_t *e, uint64_t size)
+{
+	e->p[e->pos++] = 0x01;
+	ebmlBig(e, size, 7);
+}
+
+static void ebmlSize(ebml_t *e, uint64_t size)
+{
+	if(size < 0x7f) {
+		e->p[e->pos++] = 0x80 | (uint8_t)size;
+	} else {
+		ebmlSize8(e, size);
+	}
+}
+
+// A length of 0 uses as few bytes as the value needs
+static void ebmlUint(ebml_t *e, uint32_t id, uint64_t v, int len)
+{
+	if(!len) {
+		for(len = 1; len < 8 && (v >> (len * 8)); len++);
+	}
+	ebmlId(e, id);
+	ebmlSize(e, len);
+	ebmlBig(e, v, len);
+}
+
+static void ebmlFloat(ebml_t *e, uint32_t id, double v)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &v, sizeof(bits));
+	ebmlId(e, id);
+	ebmlSize(e, sizeof(bits));
+	ebmlBig(e, bits, sizeof(bits));
+}
+
+static void ebmlBinary(ebml_t *e, uint32_t id, const void *data, size_t len)
+{
+	ebmlId(e, id);
+	ebmlSize(e, len);
+	memcpy(e->p + e->pos, data, len);
+	e->pos += len;
+}
+
+// Returns where the size goes for ebmlEnd()
+static size_t ebmlStart(ebml_t *e, uint32_t id)
+{
+	size_t at;
+
+	ebmlId(e, id);
+	at = e->pos;
+	ebmlBig(e, MKV_UNKNOWN_SIZE, 8);
+	return at;
+}
+
+static void ebmlEnd(ebml_t *e, size_t at)
+{
+	size_t pos = e->pos;
+
+	e->pos = at;
+	ebmlSize8(e, pos - at - 8);
+	e->pos = pos;
+}
+
+static void ebmlVoid(ebml_t *e, size_t len)
+{
+	e->p[e->pos++] = 0xec;
+	e->p[e->pos++] = 0x80 | (uint8_t)(len - 2);
+	memset(e->p + e->pos, 0, len - 2);
+	e->pos += len - 2;
+}
+
+// Always MKV_SEEK_SIZE, so the one for the index can replace a void. Returns where the position is.
+static size_t ebmlSeek(ebml_t *e, uint32_t id, uint64_t pos)
+{
+	ebmlId(e, 0x4dbb);
+	ebmlSize(e, MKV_SEEK_SIZE - 3);
+	ebmlUint(e, 0x53ab, id, 4);
+	ebmlUint(e, 0x53ac, pos, 8);
+	return e->pos - 8;
+}
+
+int mkvWriterInit(mkvWriter_t *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->frame = malloc(PACKED_FRAME_SIZE);
+	w->cues = malloc(MKV_MAX_CUES * sizeof(mkvCue_t));
+	if(!w->frame || !w->cues) {
+		free(w->frame);
+		free(w->cues);
+		w->frame = NULL;
+		w->cues = NULL;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+void mkvWriterFree(mkvWriter_t *w)
+{
+	free(w->frame);
+	free(w->cues);
+	w->frame = NULL;
+	w->cues = NULL;
+}
+
+// The buffers are kept, the header is written with the first frame or audio block
+static void mkvWriterReset(mkvWriter_t *w, FILE *fp)
+{
+	w->fp = fp;
+	w->started = 0;
+	w->clusterSize = -1;
+	w->end = 0;
+	w->cueCount = 0;
+	w->cueCandidates = 0;
+	w->cueStep = 1;
+	w->frames = 0;
+	w->blocks = 0;
+	w->bytes = 0;
+}
+
+static int mkvPatch(mkvWriter_t *w, off_t at, const uint8_t *p, size_t len)
+{
+	off_t end = ftello(w->fp);
+	int ok = (end >= 0 && fseeko(w->fp, at, SEEK_SET) == 0 && fwrite(p, len, 1, w->fp) == 1);
+
+	if(end >= 0 && fseeko(w->fp, end, SEEK_SET) != 0) {
+		ok = 0;
+	}
+	return ok;
+}
+
+static inline uint64_t mkvTime(mkvWriter_t *w, double time)
+{
+	double t = (time - w->start) * 1e9 / MKV_TIMESTAMP_SCALE;
+	return (t > 0) ? (uint64_t)llround(t) : 0;
+}
+
+static size_t mkvWriteHeader(mkvWriter_t *w, programData *data, const uint64_t *pixMap, double time)
+{
+	uint8_t buf[MKV_HEADER_MAX];
+	ebml_t e = { buf, 0 };
+	bmpInfoHeader_t bih;
+	size_t m, track, sub, segment, infoSeek, tracksSeek, cuesVoid, durationVoid, end;
+	uint64_t info, tracks;
+	off_t base = ftello(w->fp);
+
+	if(base < 0) {
+		return 0;
+	}
+
+	m = ebmlStart(&e, 0x1a45dfa3); // EBML
+	ebmlUint(&e, 0x4286, 1, 0); // EBMLVersion
+	ebmlUint(&e, 0x42f7, 1, 0); // EBMLReadVersion
+	ebmlUint(&e, 0x42f2, 4, 0); // EBMLMaxIDLength
+	ebmlUint(&e, 0x42f3, 8, 0); // EBMLMaxSizeLength
+	ebmlBinary(&e, 0x4282, "matroska", 8); // DocType
+	ebmlUint(&e, 0x4287, 4, 0); // DocTypeVersion
+	ebmlUint(&e, 0x4285, 2, 0); // DocTypeReadVersion
+	ebmlEnd(&e, m);
+
+	ebmlStart(&e, 0x18538067); // Segment, size filled in by mkvFinish()
+	segment = e.pos;
+
+	m = ebmlStart(&e, 0x114d9b74); // SeekHead
+	infoSeek = ebmlSeek(&e, 0x1549a966, 0);
+	tracksSeek = ebmlSeek(&e, 0x1654ae6b, 0);
+	cuesVoid = e.pos;
+	ebmlVoid(&e, MKV_SEEK_SIZE);
+	ebmlEnd(&e, m);
+
+	info = e.pos - segment;
+	m = ebmlStart(&e, 0x1549a966); // Info
+	ebmlUint(&e, 0x2ad7b1, MKV_TIMESTAMP_SCALE, 0); // TimestampScale
+	durationVoid = e.pos;
+	ebmlVoid(&e, MKV_DURATION_SIZE);
+	ebmlBinary(&e, 0x4d80, "u64view", 7); // MuxingApp
+	ebmlBinary(&e, 0x5741, "u64view", 7); // WritingApp
+	ebmlEnd(&e, m);
+
+	memset(&bih, 0, sizeof(bih));
+	bih.size = offsetof(bmpInfoHeader_t, colors);
+	bih.width = data->width;
+	bih.height = -data->height;
+	bih.planes = 1;
+	bih.bitCount = 4;
+	bih.sizeImage = PACKED_FRAME_SIZE;
+	bih.clrUsed = NATIVE_PALETTE_SIZE;
+	for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+		uint32_t c = (uint32_t)pixMap[i];
+		bih.colors[i][0] = (c >> 8) & 0xff;
+		bih.colors[i][1] = (c >> 16) & 0xff;
+		bih.colors[i][2] = c >> 24;
+	}
+
+	tracks = e.pos - segment;
+	m = ebmlStart(&e, 0x1654ae6b); // Tracks
+	track = ebmlStart(&e, 0xae); // TrackEntry
+	ebmlUint(&e, 0xd7, 1, 0); // TrackNumber
+	ebmlUint(&e, 0x73c5, 1, 0); // TrackUID
+	ebmlUint(&e, 0x83, 1, 0); // TrackType, video
+	ebmlUint(&e, 0x9c, 0, 0); // FlagLacing
+	ebmlBinary(&e, 0x86, "V_MS/VFW/FOURCC", 15); // CodecID
+	ebmlBinary(&e, 0x63a2, &bih, sizeof(bih)); // CodecPrivate
+	ebmlUint(&e, 0x23e383, (uint64_t)llround(data->clock.video.period * 1e9), 0); // DefaultDuration in ns
+	sub = ebmlStart(&e, 0xe0); // Video
+	ebmlUint(&e, 0xb0, data->width, 0); // PixelWidth
+	ebmlUint(&e, 0xba, data->height, 0); // PixelHeight
+	ebmlEnd(&e, sub);
+	ebmlEnd(&e, track);
+	track = ebmlStart(&e, 0xae);
+	ebmlUint(&e, 0xd7, 2, 0);
+	ebmlUint(&e, 0x73c5, 2, 0);
+	ebmlUint(&e, 0x83, 2, 0); // Audio
+	ebmlUint(&e, 0x9c, 0, 0);
+	ebmlBinary(&e, 0x86, "A_PCM/INT/LIT", 13);
+	sub = ebmlStart(&e, 0xe1); // Audio
+	ebmlFloat(&e, 0xb5, U64_AUDIO_FREQUENCY); // SamplingFrequency
+	ebmlUint(&e, 0x9f, AUDIO_CHANNELS, 0); // Channels
+	ebmlUint(&e, 0x6264, 16, 0); // BitDepth
+	ebmlEnd(&e, sub);
+	ebmlEnd(&e, track);
+	ebmlEnd(&e, m);
+
+	end = e.pos;
+	e.pos = infoSeek;
+	ebmlBig(&e, info, 8);
+	e.pos = tracksSeek;
+	ebmlBig(&e, tracks, 8);
+	e.pos = end;
+
+	w->started = 1;
+	w->start = time;
+	w->segment = base + segment;
+	w->cuesSeek = base + cuesVoid;
+	w->duration = base + durationVoid;
+	w->bytes += e.pos;
+	memcpy(w->pixMap, pixMap, sizeof(w->pixMap));
+	return fwrite(buf, e.pos, 1, w->fp);
+}
+
+static size_t mkvCloseCluster(mkvWriter_t *w)
+{
+	uint8_t buf[8];
+	ebml_t e = { buf, 0 };
+	off_t end = ftello(w->fp);
+
+	if(w->clusterSize < 0) {
+		return 1;
+	}
+	if(end < 0) {
+		return 0;
+	}
+	ebmlSize8(&e, end - w->clusterSize - 8);
+	off_t at = w->clusterSize;
+	w->clusterSize = -1;
+	return mkvPatch(w, at, buf, e.pos);
+}
+
+static size_t mkvOpenCluster(mkvWriter_t *w, uint64_t time)
+{
+	uint8_t buf[32];
+	ebml_t e = { buf, 0 };
+	off_t pos;
+
+	if(!mkvCloseCluster(w) || (pos = ftello(w->fp)) < 0) {
+		return 0;
+	}
+	ebmlStart(&e, 0x1f43b675); // Cluster
+	ebmlUint(&e, 0xe7, time, 0); // Timestamp
+	w->clusterSize = pos + 4;
+	w->clusterPos = pos - w->segment;
+	w->clusterTime = time;
+	w->clusterFrames = 0;
+	w->bytes += e.pos;
+	return fwrite(buf, e.pos, 1, w->fp);
+}
+
+// The index only ever takes MKV_MAX_CUES, when it is full every other cue goes and from then on only every other cluster gets one
+static void mkvAddCue(mkvWriter_t *w, uint64_t time)
+{
+	if(w->cueCandidates++ % w->cueStep) {
+		return;
+	}
+	if(w->cueCount == MKV_MAX_CUES) {
+		for(int i=0; i < MKV_MAX_CUES / 2; i++) {
+			w->cues[i] = w->cues[i * 2];
+		}
+		w->cueCount = MKV_MAX_CUES / 2;
+		w->cueStep *= 2;
+		if((w->cueCandidates - 1) % w->cueStep) {
+			return;
+		}
+	}
+	w->cues[w->cueCount].time = time;
+	w->cues[w->cueCount].pos = w->clusterPos;
+	w->cueCount++;
+}
+
+// A new cluster every MKV_CLUSTER_FRAMES frames, or sooner if a block wouldn't fit the 16 bit time in it
+static size_t mkvWriteBlock(mkvWriter_t *w, int track, const void *payload, size_t len, double time, double length)
+{
+	uint8_t buf[16];
+	ebml_t e = { buf, 0 };
+	uint64_t t = mkvTime(w, time);
+
+	if(w->clusterSize < 0 || (track == 1 && w->clusterFrames >= MKV_CLUSTER_FRAMES) || t > w->clusterTime + INT16_MAX) {
+		if(!mkvOpenCluster(w, t)) {
+			return 0;
+		}
+	}
+	// Every frame is a keyframe, the index points at the first one in each cluster
+	if(track == 1 && w->clusterFrames++ == 0) {
+		mkvAddCue(w, t);
+	}
+	if(t + mkvTime(w, w->start + length) > w->end) {
+		w->end = t + mkvTime(w, w->start + length);
+	}
+
+	ebmlId(&e, 0xa3); // SimpleBlock
+	ebmlSize8(&e, len + 4);
+	e.p[e.pos++] = 0x80 | track;
+	ebmlBig(&e, (uint16_t)(int16_t)(t - w->clusterTime), 2);
+	e.p[e.pos++] = 0x80; // Keyframe
+	w->bytes += e.pos + len;
+	return fwrite(buf, e.pos, 1, w->fp) == 1 && fwrite(payload, len, 1, w->fp) == 1;
+}
+
+static size_t mkvWriteFrame(mkvWriter_t *w, programData *data, const uint8_t *frame, const uint64_t *pixMap, double time)
+{
+	if(unlikely(!w->started) && !mkvWriteHeader(w, data, pixMap, time)) {
+		return 0;
+	}
+	// BI_RGB has the left pixel in the high nibble
+	for(int i=0; i < PACKED_FRAME_SIZE; i++) {
+		w->frame[i] = (uint8_t)(frame[i] << 4 | frame[i] >> 4);
+	}
+	w->frames++;
+	return mkvWriteBlock(w, 1, w->frame, PACKED_FRAME_SIZE, time, data->clock.video.period);
+}
+
+// The colors come with the block, audio can start a file before the first frame does
+static size_t mkvWriteAudio(mkvWriter_t *w, programData *data, const void *block, const uint64_t *pixMap, double time)
+{
+	if(unlikely(!w->started) && !mkvWriteHeader(w, data, pixMap, time)) {
+		return 0;
+	}
+	w->blocks++;
+	return mkvWriteBlock(w, 2, block, SAMPLE_SIZE, time, (double)(SAMPLE_SIZE / AUDIO_FRAME_SIZE) / U64_AUDIO_FREQUENCY);
+}
+
+// Closes the last cluster, writes the index and fills in what wasn't known while recording
+static size_t mkvFinish(mkvWriter_t *w)
+{
+	uint8_t buf[64];
+	ebml_t e = { buf, 0 };
+	size_t ok;
+	off_t cues, end;
+
+	if(!w->started) {
+		return 1;
+	}
+	ok = mkvCloseCluster(w);
+	if((cues = ftello(w->fp)) < 0) {
+		return 0;
+	}
+	if(w->cueCount) {
+		ebmlId(&e, 0x1c53bb6b); // Cues
+		ebmlSize8(&e, (uint64_t)w->cueCount * MKV_CUE_POINT_SIZE);
+		ok &= fwrite(buf, e.pos, 1, w->fp);
+		for(int i=0; i < w->cueCount; i++) {
+			e.pos = 0;
+			ebmlId(&e, 0xbb); // CuePoint
+			ebmlSize(&e, MKV_CUE_POINT_SIZE - 2);
+			ebmlUint(&e, 0xb3, w->cues[i].time, 8); // CueTime
+			ebmlId(&e, 0xb7); // CueTrackPositions
+			ebmlSize(&e, MKV_CUE_POINT_SIZE - 14);
+			ebmlUint(&e, 0xf7, 1, 1); // CueTrack
+			ebmlUint(&e, 0xf1, w->cues[i].pos, 8); // CueClusterPosition
+			ok &= fwrite(buf, e.pos, 1, w->fp);
+		}
+		e.pos = 0;
+		ebmlSeek(&e, 0x1c53bb6b, cues - w->segment);
+		ok &= mkvPatch(w, w->cuesSeek, buf, e.pos);
+	}
+
+	e.pos = 0;
+	ebmlFloat(&e, 0x4489, (double)w->end); // Duration
+	ok &= mkvPatch(w, w->duration, buf, e.pos);
+	if((end = ftello(w->fp)) < 0) {
+		return 0;
+	}
+	e.pos = 0;
+	ebmlSize8(&e, end - w->segment);
+	ok &= mkvPatch(w, w->segment - 8, buf, e.pos);
+	return ok;
+}
+
+#ifdef __linux__
+// Writeback of each stretch is started as soon as it is complete, and the one before is dropped from the page cache once it
+// is on disk. Dirty pages then never pile up until the kernel throttles the writer, and hours of recording don't fill memory.
+static int recWriteback(recOut_t *o)
+{
+	off_t pos = ftello(o->fp);
+
+	if(pos < 0 || (uint64_t)pos < o->started + REC_WRITEBACK_SIZE) {
+		return EXIT_SUCCESS;
+	}
+	if(fflush(o->fp) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	int fd = fileno(o->fp);
+	sync_file_range(fd, o->started, pos - o->started, SYNC_FILE_RANGE_WRITE);
+	if(o->started > o->dropped) {
+		sync_file_range(fd, o->dropped, o->started - o->dropped,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, o->dropped, o->started - o->dropped, POSIX_FADV_DONTNEED);
+		o->dropped = o->started;
+	}
+	o->started = pos;
+
+	// Allocated well ahead so each file stays in few extents while the others grow along with it
+	if(o->allocated < (uint64_t)pos + REC_WRITEBACK_SIZE) {
+		if(fallocate(fd, FALLOC_FL_KEEP_SIZE, o->allocated, REC_PREALLOC_SIZE) == 0) {
+			o->allocated += REC_PREALLOC_SIZE;
+		} else {
+			o->allocated = UINT64_MAX;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static void recOutOpen(recOut_t *o, FILE *fp)
+{
+	memset(o, 0, sizeof(*o));
+	o->fp = fp;
+	if(fp && fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, REC_PREALLOC_SIZE) == 0) {
+		o->allocated = REC_PREALLOC_SIZE;
+	}
+}
+
+// Give back what was allocated past the end
+static void recOutClose(recOut_t *o)
+{
+	if(o->fp && fflush(o->fp) == 0 && o->allocated) {
+		fseeko(o->fp, 0, SEEK_END);
+		if(ftruncate(fileno(o->fp), ftello(o->fp)) != 0) {
+			printf("Warning: Could not trim the space preallocated for a recording.\n");
+		}
+	}
+	o->fp = NULL;
+}
+#endif
+
+static void recLatency(recorder_t *rec, double seconds)
+{
+	double us = seconds * 1e6;
+	int b = (us < 1) ? 0 : (int)(log2(us) * REC_LATENCY_STEPS) + 1;
+
+	if(b >= REC_LATENCY_BUCKETS) {
+		b = REC_LATENCY_BUCKETS - 1;
+	}
+	rec->latency[b]++;
+	rec->writes++;
+	if(seconds > rec->maxLatency) {
+		rec->maxLatency = seconds;
+	}
+}
+
+// Upper end of the bucket the percentile falls in, in milliseconds
+static double recLatencyPercentile(recorder_t *rec, double p)
+{
+	uint64_t want = (uint64_t)ceil(rec->writes * p / 100.0), sum = 0;
+
+	for(int b=0; b < REC_LATENCY_BUCKETS; b++) {
+		sum += rec->latency[b];
+		if(sum >= want) {
+			return pow(2.0, (double)b / REC_LATENCY_STEPS) / 1000.0;
+		}
+	}
+	return rec->maxLatency * 1000.0;
+}
+
+static void recSegmentDiscard(recSegment_t *s)
+{
+	FILE *fp[4] = { s->vfp, s->afp, s->nfp, s->mfp };
+	const char *name[4] = { s->rawName, s->rawName, s->nativeName, s->mkvName };
+	const char *ext[4] = { "rgb", "pcm", "u64", "mkv" };
+	char fn[MAX_STRING_SIZE + 32];
+
+	for(int i=0; i < 4; i++) {
+		if(fp[i]) {
+			fclose(fp[i]);
+			snprintf(fn, sizeof(fn), "%s.%s", name[i], ext[i]);
+			remove(fn);
+		}
+	}
+	s->open = 0;
+}
+
+static inline const char* recSegmentName(recSegment_t *s)
+{
+	return s->vfp ? s->rawName : s->nfp ? s->nativeName : s->mkvName;
+}
+
+// The first segment keeps the plain name, unless the recording is going to be split anyway
+static int recSegmentOpen(programData *data, recSegment_t *s, int number)
+{
+	recorder_t *rec = &data->rec;
+	char fn[MAX_STRING_SIZE + 32];
+
+	memset(s, 0, sizeof(*s));
+	s->number = number;
+	if(number == 0 && !rec->segSeconds && !rec->segBytes) {
+		snprintf(s->rawName, sizeof(s->rawName), "%s", data->recName);
+		snprintf(s->nativeName, sizeof(s->nativeName), "%s", data->nativeName);
+		snprintf(s->mkvName, sizeof(s->mkvName), "%s", data->mkvName);
+	} else {
+		snprintf(s->rawName, sizeof(s->rawName), "%s-%04i", data->recName, number + 1);
+		snprintf(s->nativeName, sizeof(s->nativeName), "%s-%04i", data->nativeName, number + 1);
+		snprintf(s->mkvName, sizeof(s->mkvName), "%s-%04i", data->mkvName, number + 1);
+	}
+
+	if(strlen(data->recName)) {
+		snprintf(fn, sizeof(fn), "%s.rgb", s->rawName);
+		s->vfp = fopen(fn, "w");
+		if(s->vfp) {
+			snprintf(fn, sizeof(fn), "%s.pcm", s->rawName);
+			s->afp = fopen(fn, "w");
+		}
+		if(!s->afp) {
+			goto fail;
+		}
+	}
+	if(strlen(data->nativeName)) {
+		snprintf(fn, sizeof(fn), "%s.u64", s->nativeName);
+		s->nfp = fopen(fn, "wb");
+		if(!s->nfp) {
+			goto fail;
+		}
+	}
+	if(strlen(data->mkvName)) {
+		snprintf(fn, sizeof(fn), "%s.mkv", s->mkvName);
+		s->mfp = fopen(fn, "wb");
+		if(!s->mfp) {
+			goto fail;
+		}
+	}
+
+#ifdef __linux__
+	if(rec->writeback) {
+		recOutOpen(&s->out[0], s->vfp);
+		recOutOpen(&s->out[1], s->afp);
+		recOutOpen(&s->out[2], s->nfp);
+		recOutOpen(&s->out[3], s->mfp);
+	}
+#endif
+	s->open = 1;
+	return EXIT_SUCCESS;
+
+fail:
+	printf("Error opening %s for writing.\n", fn);
+	recSegmentDiscard(s);
+	return EXIT_FAILURE;
+}
+
+static void recSegmentClose(programData *data, recSegment_t *s)
+{
+	recorder_t *rec = &data->rec;
+	int error = 0;
+
+	if(s->nfp) {
+		writeNativeHeader(&rec->native, data);
+		if(rec->native.frames) {
+			printf("Recorder: %"PRIu64" frames coded to %.1f%% of their packed size, %"PRIu64" of them repeats.\n",
+				rec->native.frames, 100.0 * rec->native.bytes / ((double)rec->native.frames * PACKED_FRAME_SIZE), rec->native.repeats);
+		}
+		rec->native.fp = NULL;
+	}
+	if(s->mfp) {
+		if(!mkvFinish(&rec->mkv)) {
+			error = 1;
+		}
+		rec->mkv.fp = NULL;
+	}
+#ifdef __linux__
+	if(rec->writeback) {
+		for(int i=0; i < 4; i++) {
+			recOutClose(&s->out[i]);
+		}
+	}
+#endif
+	if(s->vfp) {
+		error |= fclose(s->vfp);
+		error |= fclose(s->afp);
+		if(s->videoStarted && s->audioStarted) {
+			writeSyncFile(s->rawName, data->clock.video.period, s->videoStart, s->audioStart);
+		}
+	}
+	if(s->nfp) {
+		error |= fclose(s->nfp);
+	}
+	if(s->mfp) {
+		error |= fclose(s->mfp);
+	}
+	if(error && !rec->writeError) {
+		rec->writeError = 1;
+		printf("Error writing recording, is the disk full?\n");
+	}
+	printf("Recorder: closed %s, %"PRIu64" frames and %"PRIu64" audio blocks.\n", recSegmentName(s), s->frames, s->blocks);
+	s->open = 0;
+}
+
+// What the segment takes on disk so far, close enough for deciding when to split
+static inline uint64_t recSegmentBytes(programData *data, recSegment_t *s)
+{
+	uint64_t bytes = 0;
+
+	if(s->vfp) {
+		bytes += s->frames * sizeof(uint32_t) * data->width * data->height + s->blocks * SAMPLE_SIZE;
+	}
+	if(s->nfp) {
+		bytes += data->rec.native.bytes + (s->frames + s->blocks) * sizeof(nativeChunk_t) + s->blocks * SAMPLE_SIZE;
+	}
+	if(s->mfp) {
+		bytes += s->mkvBytes + data->rec.mkv.bytes;
+	}
+	return bytes;
+}
+
+// Splits go before a frame, so each segment starts with a whole frame and the audio that goes with it
+static int recSegmentDue(programData *data, recBuf_t *b)
+{
+	recorder_t *rec = &data->rec;
+	recSegment_t *s = &rec->cur;
+
+	if(b->take != rec->segTake) {
+		return 1;
+	}
+	if(!s->open || b->kind != REC_VIDEO || !s->frames) {
+		return 0;
+	}
+	return (rec->segSeconds > 0 && s->videoStarted && b->time - s->videoStart >= rec->segSeconds) ||
+		(rec->segBytes && recSegmentBytes(data, s) >= rec->segBytes);
+}
+
+// Hands over to the files opened ahead, or opens them now if that didn't happen yet
+static int recSegmentSwitch(programData *data, recBuf_t *b)
+{
+	recorder_t *rec = &data->rec;
+
+	// Buffers of this take are dropped if the files can't be opened, rather than trying again for each
+	rec->segTake = b->take;
+	if(rec->cur.open) {
+		recSegmentClose(data, &rec->cur);
+	}
+	if(!rec->next.open && recSegmentOpen(data, &rec->next, rec->segments) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	rec->cur = rec->next;
+	rec->next.open = 0;
+	rec->segments++;
+
+	if(rec->cur.nfp) {
+		rec->native.fp = rec->cur.nfp;
+		rec->native.frames = 0;
+		rec->native.blocks = 0;
+		rec->native.bytes = 0;
+		rec->native.repeats = 0;
+		writeNativeHeader(&rec->native, data);
+	}
+	if(rec->cur.mfp) {
+		mkvWriterReset(&rec->mkv, rec->cur.mfp);
+	}
+	printf("Recorder: recording to %s.\n", recSegmentName(&rec->cur));
+	return EXIT_SUCCESS;
+}
+
+// A Matroska track has one set of colors, changing them goes on in FN-part2.mkv and so on, the other outputs don't mind
+static size_t recMkvNextPart(programData *data, recSegment_t *s)
+{
+	recorder_t *rec = &data->rec;
+	char fn[MAX_STRING_SIZE + 48];
+	size_t ok = mkvFinish(&rec->mkv);
+
+	s->mkvBytes += rec->mkv.bytes;
+#ifdef __linux__
+	if(rec->writeback) {
+		recOutClose(&s->out[3]);
+	}
+#endif
+	if(fclose(s->mfp)) {
+		ok = 0;
+	}
+	s->mkvPart++;
+	snprintf(fn, sizeof(fn), "%s-part%i.mkv", s->mkvName, s->mkvPart + 1);
+	s->mfp = fopen(fn, "wb");
+	mkvWriterReset(&rec->mkv, s->mfp);
+	if(!s->mfp) {
+		printf("Error opening %s for writing, the rest of the Matroska recording is lost.\n", fn);
+		return 0;
+	}
+#ifdef __linux__
+	if(rec->writeback) {
+		recOutOpen(&s->out[3], s->mfp);
+	}
+#endif
+	printf("Recorder: colors changed, Matroska recording goes on in %s.\n", fn);
+	return ok;
+}
+
+static void recWriteBuffer(programData *data, recBuf_t *b)
+{
+	recorder_t *rec = &data->rec;
+	recSegment_t *s = &rec->cur;
+	size_t written = 1;
+	uint64_t start;
+
+	if(unlikely(recSegmentDue(data, b))) {
+		recSegmentSwitch(data, b);
+	}
+
+	start = SDL_GetPerformanceCounter();
+	if(unlikely(!s->open)) {
+		written = 0;
+	} else if(b->kind == REC_VIDEO) {
+		// Timed from after the expansion, coding the .u64 frames is counted though
+		if(s->vfp) {
+			expandPacked(b->data, b->pixMap, rec->argb, data->width, data->height, data->width / 2);
+		}
+		start = SDL_GetPerformanceCounter();
+		if(s->vfp) {
+			written = fwrite(rec->argb, sizeof(uint32_t) * data->width * data->height, 1, s->vfp);
+		}
+		if(s->nfp) {
+			uint32_t palette[NATIVE_PALETTE_SIZE];
+			pixMapPalette(b->pixMap, palette);
+			written &= writeNativeFrame(&rec->native, b->data, palette, b->seq, b->time);
+		}
+		if(s->mfp && unlikely(rec->mkv.started && memcmp(b->pixMap, rec->mkv.pixMap, sizeof(rec->mkv.pixMap)))) {
+			written &= recMkvNextPart(data, s);
+		}
+		if(s->mfp) {
+			written &= mkvWriteFrame(&rec->mkv, data, b->data, b->pixMap, b->time);
+		}
+		if(!s->videoStarted) {
+			s->videoStarted = 1;
+			s->videoStart = b->time;
+		}
+		s->frames++;
+	} else {
+		start = SDL_GetPerformanceCounter();
+		if(s->afp) {
+			written = fwrite(b->data, SAMPLE_SIZE, 1, s->afp);
+		}
+		if(s->nfp) {
+			written &= writeNativeAudio(&rec->native, b->data, b->seq, b->time);
+		}
+		if(s->mfp) {
+			written &= mkvWriteAudio(&rec->mkv, data, b->data, b->pixMap, b->time);
+		}
+		if(!s->audioStarted) {
+			s->audioStarted = 1;
+			s->audioStart = b->time;
+		}
+		s->blocks++;
+	}
+#ifdef __linux__
+	if(rec->writeback && s->open) {
+		for(int i=0; i < 4; i++) {
+			if(s->out[i].fp && recWriteback(&s->out[i]) != EXIT_SUCCESS) {
+				written = 0;
+			}
+		}
+	}
+#endif
+	recLatency(rec, (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+
+	if(unlikely(written != 1 && !rec->writeError)) {
+		rec->writeError = 1;
+		printf("Error writing recording, is the disk full?\n");
+	}
+}
+
+static void recDrain(programData *data)
+{
+	recorder_t *rec = &data->rec;
+	recBuf_t *b;
+
+	while((b = recPop(&rec->filled))) {
+		recWriteBuffer(data, b);
+		recPush(b->kind == REC_VIDEO ? &rec->freeVideo : &rec->freeAudio, b);
+		SDL_AtomicAdd(&rec->backlog, -1);
+	}
+}
+
+static int recorderThread(void *ptr)
+{
+	programData *data = (programData*)ptr;
+	recorder_t *rec = &data->rec;
+
+	while(SDL_AtomicGet(&rec->run) || SDL_AtomicGet(&rec->backlog)) {
+		SDL_SemWaitTimeout(rec->sem, SDLNET_STREAM_TIMEOUT);
+		recDrain(data);
+
+		// Finish the segment as soon as recording is stopped, not when it starts again
+		if(!SDL_AtomicGet(&rec->active) && rec->cur.open) {
+			recDrain(data); // What was queued before the stop
+			recSegmentClose(data, &rec->cur);
+		}
+		// Open the next files while there is time, so the switch to them never waits on the disk.
+		// Only when a switch is coming, opening truncates and an unused one is removed at exit,
+		// so it would take a file of an earlier recording with it.
+		if(!rec->next.open && rec->nextTried != rec->segments && SDL_AtomicGet(&rec->run) &&
+		   (rec->segSeconds > 0 || rec->segBytes || !SDL_AtomicGet(&rec->active))) {
+			rec->nextTried = rec->segments;
+			recSegmentOpen(data, &rec->next, rec->segments);
+		}
+	}
+
+	if(rec->cur.open) {
+		recSegmentClose(data, &rec->cur);
+	}
+	if(rec->next.open) {
+		recSegmentDiscard(&rec->next);
+	}
+
+	return 0;
+}
+
+// Starting again records to the next segment, the writer thread does the opening and closing
+void toggleRecording(programData *data)
+{
+	recorder_t *rec = &data->rec;
+
+	if(!rec->thread) {
+		printf("Can only record when started with -o, -O or -M.\n");
+		return;
+	}
+	if(SDL_AtomicGet(&rec->active)) {
+		SDL_AtomicSet(&rec->active, 0);
+		printf("Recording stopped, press o to start again.\n");
+	} else {
+		rec->take++;
+		SDL_AtomicSet(&rec->active, 1);
+		printf("Recording started.\n");
+	}
+	SDL_SemPost(rec->sem);
+}
+
+// Hand a buffer to the writer thread and keep track of how far behind it gets
+static inline void recSubmit(recorder_t *rec, recBuf_t *b)
+{
+	recPush(&rec->filled, b);
+	int backlog = SDL_AtomicAdd(&rec->backlog, 1) + 1;
+	if(unlikely(backlog > rec->highWater)) {
+		rec->highWater = backlog;
+	}
+	SDL_SemPost(rec->sem);
+}
+
+void recordFrame(programData *data, const uint8_t *packed, uint64_t frame, double time)
+{
+	recorder_t *rec = &data->rec;
+	recBuf_t *b = recPop(&rec->freeVideo);
+
+	if(unlikely(!b)) {
+		rec->droppedFrames++;
+		return;
+	}
+	memcpy(b->data, packed, PACKED_FRAME_SIZE);
+	memcpy(b->pixMap, data->pixMap, sizeof(data->pixMap));
+	b->seq = frame;
+	b->time = time;
+	b->take = rec->take;
+	recSubmit(rec, b);
+}
+
+void recordAudio(programData *data, const int16_t *block, uint64_t seq, double time)
+{
+	recorder_t *rec = &data->rec;
+	recBuf_t *b = recPop(&rec->freeAudio);
+
+	if(unlikely(!b)) {
+		rec->droppedBlocks++;
+		return;
+	}
+	memcpy(b->data, block, SAMPLE_SIZE);
+	memcpy(b->pixMap, data->pixMap, NATIVE_PALETTE_SIZE * sizeof(uint64_t));
+	b->seq = seq;
+	b->time = time;
+	b->take = rec->take;
+	recSubmit(rec, b);
+}
+
+void stopRecorder(programData *data)
+{
+	recorder_t *rec = &data->rec;
+
+	if(rec->thread) {
+		SDL_AtomicSet(&rec->run, 0);
+		SDL_SemPost(rec->sem);
+		SDL_WaitThread(rec->thread, NULL);
+		rec->thread = NULL;
+
+		if(data->verbose || rec->droppedFrames || rec->droppedBlocks) {
+			printf("Recorder: backlog high-water mark %i buffers, %"PRIu64" frames and %"PRIu64" audio blocks dropped because the disk was too slow.\n",
+				rec->highWater, rec->droppedFrames, rec->droppedBlocks);
+		}
+		if(data->verbose && rec->writes) {
+			printf("Recorder: write latency over %"PRIu64" buffers p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms.\n",
+				rec->writes, recLatencyPercentile(rec, 50), recLatencyPercentile(rec, 90), recLatencyPercentile(rec, 99),
+				recLatencyPercentile(rec, 99.9), rec->maxLatency * 1000.0);
+		}
+	}
+	// Opened before the thread was started
+	if(rec->next.open) {
+		recSegmentDiscard(&rec->next);
+	}
+
+	if(rec->sem) {
+		SDL_DestroySemaphore(rec->sem);
+		rec->sem = NULL;
+	}
+	free(rec->bufs);
+	free(rec->pool);
+	free(rec->argb);
+	nativeWriterFree(&rec->native);
+	mkvWriterFree(&rec->mkv);
+	rec->bufs = NULL;
+	rec->pool = NULL;
+	rec->argb = NULL;
+}
+
+// All buffers are allocated up front, the receive path only copies into a free one and passes the pointer on
+int startRecorder(programData *data)
+{
+	recorder_t *rec = &data->rec;
+	size_t videoSize = PACKED_FRAME_SIZE + sizeof(data->pixMap);
+	size_t audioSize = SAMPLE_SIZE + NATIVE_PALETTE_SIZE * sizeof(uint64_t); // Just the colors, for a Matroska header
+	uint8_t *p;
+
+	rec->bufs = calloc(REC_VIDEO_BUFFERS + REC_AUDIO_BUFFERS, sizeof(recBuf_t));
+	rec->pool = malloc(REC_VIDEO_BUFFERS * videoSize + REC_AUDIO_BUFFERS * audioSize);
+	rec->argb = malloc(sizeof(uint32_t) * data->width * data->height);
+	rec->sem = SDL_CreateSemaphore(0);
+	if(!rec->bufs || !rec->pool || !rec->argb || !rec->sem || nativeWriterInit(&rec->native, NULL) != EXIT_SUCCESS ||
+	   mkvWriterInit(&rec->mkv) != EXIT_SUCCESS) {
+		printf("Error: Could not allocate recorder buffers.\n");
+		stopRecorder(data);
+		return EXIT_FAILURE;
+	}
+
+	p = rec->pool;
+	for(int i=0; i < REC_VIDEO_BUFFERS + REC_AUDIO_BUFFERS; i++) {
+		recBuf_t *b = &rec->bufs[i];
+		if(i < REC_VIDEO_BUFFERS) {
+			b->kind = REC_VIDEO;
+			b->pixMap = (uint64_t*)p;
+			b->data = p + sizeof(data->pixMap);
+			p += videoSize;
+			recPush(&rec->freeVideo, b);
+		} else {
+			b->kind = REC_AUDIO;
+			b->pixMap = (uint64_t*)p;
+			b->data = p + NATIVE_PALETTE_SIZE * sizeof(uint64_t);
+			p += audioSize;
+			recPush(&rec->freeAudio, b);
+		}
+	}
+
+#ifndef __linux__
+	if(rec->writeback) {
+		printf("Write-through recording is not supported on this platform, recording through the page cache.\n");
+		rec->writeback = 0;
+	}
+#endif
+
+	// Opened here so a bad name stops u64view right away, later segments are opened by the writer thread
+	if(recSegmentOpen(data, &rec->next, 0) != EXIT_SUCCESS) {
+		stopRecorder(data);
+		return EXIT_FAILURE;
+	}
+
+	rec->take = 1;
+	SDL_AtomicSet(&rec->active, !data->recordPaused);
+	if(data->recordPaused) {
+		printf("Press o to start recording.\n");
+	}
+	SDL_AtomicSet(&rec->run, 1);
+	rec->thread = SDL_CreateThread(recorderThread, "recorder", data);
+	if(!rec->thread) {
+		printf("Error creating recorder thread: %s\n", SDL_GetError());
+		stopRecorder(data);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Pipes, Y4M video and raw audio for an encoder to read as it comes in
+static void yuvExpandScalar(const uint8_t *packed, const uint8_t *lut, uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	for(int i=0; i < n; i++) {
+		int lo = packed[i] & 0x0f;
+		int hi = packed[i] >> 4;
+		y[i * 2] = lut[lo];
+		y[i * 2 + 1] = lut[hi];
+		u[i * 2] = lut[NATIVE_PALETTE_SIZE + lo];
+		u[i * 2 + 1] = lut[NATIVE_PALETTE_SIZE + hi];
+		v[i * 2] = lut[NATIVE_PALETTE_SIZE * 2 + lo];
+		v[i * 2 + 1] = lut[NATIVE_PALETTE_SIZE * 2 + hi];
+	}
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// With only 16 colors the conversion is a table lookup, pshufb does 16 of them at once
+__attribute__((target("ssse3")))
+static void yuvExpandSsse3(const uint8_t *packed, const uint8_t *lut, uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i ly = _mm_loadu_si128((const __m128i*)lut);
+	const __m128i lu = _mm_loadu_si128((const __m128i*)(lut + NATIVE_PALETTE_SIZE));
+	const __m128i lv = _mm_loadu_si128((const __m128i*)(lut + NATIVE_PALETTE_SIZE * 2));
+	int i = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(packed + i));
+		__m128i lo = _mm_and_si128(p, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(p, 4), mask);
+		// Back in pixel order, the low nibble is the left pixel
+		__m128i a = _mm_unpacklo_epi8(lo, hi);
+		__m128i b = _mm_unpackhi_epi8(lo, hi);
+		_mm_storeu_si128((__m128i*)(y + i * 2), _mm_shuffle_epi8(ly, a));
+		_mm_storeu_si128((__m128i*)(y + i * 2 + 16), _mm_shuffle_epi8(ly, b));
+		_mm_storeu_si128((__m128i*)(u + i * 2), _mm_shuffle_epi8(lu, a));
+		_mm_storeu_si128((__m128i*)(u + i * 2 + 16), _mm_shuffle_epi8(lu, b));
+		_mm_storeu_si128((__m128i*)(v + i * 2), _mm_shuffle_epi8(lv, a));
+		_mm_storeu_si128((__m128i*)(v + i * 2 + 16), _mm_shuffle_epi8(lv, b));
+	}
+	yuvExpandScalar(packed + i, lut, y + i * 2, u + i * 2, v + i * 2, n - i);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static void yuvExpandNeon(const uint8_t *packed, const uint8_t *lut, uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	const uint8x16_t ly = vld1q_u8(lut);
+	const uint8x16_t lu = vld1q_u8(lut + NATIVE_PALETTE_SIZE);
+	const uint8x16_t lv = vld1q_u8(lut + NATIVE_PALETTE_SIZE * 2);
+	int i = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		uint8x16_t p = vld1q_u8(packed + i);
+		uint8x16x2_t px = vzipq_u8(vandq_u8(p, vdupq_n_u8(0x0f)), vshrq_n_u8(p, 4));
+		vst1q_u8(y + i * 2, vqtbl1q_u8(ly, px.val[0]));
+		vst1q_u8(y + i * 2 + 16, vqtbl1q_u8(ly, px.val[1]));
+		vst1q_u8(u + i * 2, vqtbl1q_u8(lu, px.val[0]));
+		vst1q_u8(u + i * 2 + 16, vqtbl1q_u8(lu, px.val[1]));
+		vst1q_u8(v + i * 2, vqtbl1q_u8(lv, px.val[0]));
+		vst1q_u8(v + i * 2 + 16, vqtbl1q_u8(lv, px.val[1]));
+	}
+	yuvExpandScalar(packed + i, lut, y + i * 2, u + i * 2, v + i * 2, n - i);
+}
+#endif
+
+static void pipeSelectKernel(pipeWriter_t *p)
+{
+	p->expand = yuvExpandScalar;
+	p->kernelName = "scalar";
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	if(SDL_HasSSSE3()) {
+		p->expand = yuvExpandSsse3;
+		p->kernelName = "ssse3";
+	}
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	p->expand = yuvExpandNeon;
+	p->kernelName = "neon";
+#endif
+}
+
+// BT.601 studio range, what Y4M readers assume when nothing else is said
+static void pipeBuildLut(pipeWriter_t *p, const uint64_t *pixMap)
+{
+	for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+		uint32_t c = (uint32_t)pixMap[i];
+		double r = c >> 24, g = (c >> 16) & 0xff, b = (c >> 8) & 0xff;
+		p->lut[i] = (uint8_t)lround(16.0 + (65.481 * r + 128.553 * g + 24.966 * b) / 255.0);
+		p->lut[NATIVE_PALETTE_SIZE + i] = (uint8_t)lround(128.0 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255.0);
+		p->lut[NATIVE_PALETTE_SIZE * 2 + i] = (uint8_t)lround(128.0 + (112.0 * r - 93.786 * g - 18.214 * b) / 255.0);
+		p->palette[i] = pixMap[i];
+	}
+}
+
+static int pipeWrite(pipeWriter_t *p, recBuf_t *b)
+{
+	if(b->kind == REC_AUDIO) {
+		return fwrite(b->data, SAMPLE_SIZE, 1, p->fp) == 1;
+	}
+
+	int size = p->width * p->height;
+	if(!p->written) {
+		// Frame rate as the exact ratio of the VIC clock
+		int pal = (p->period == PAL_FRAME_PERIOD);
+		fprintf(p->fp, "YUV4MPEG2 W%i H%i F%i:%i Ip A1:1 C444\n", p->width, p->height,
+			pal ? 985248 : 1022727, pal ? 19656 : 17095);
+	}
+	if(!p->written || memcmp(p->palette, b->pixMap, sizeof(p->palette))) {
+		pipeBuildLut(p, b->pixMap);
+	}
+	uint8_t *y = p->out + sizeof(Y4M_FRAME_HEADER) - 1;
+	p->expand(b->data, p->lut, y, y + size, y + size * 2, PACKED_FRAME_SIZE);
+	return fwrite(p->out, sizeof(Y4M_FRAME_HEADER) - 1 + size * 3, 1, p->fp) == 1;
+}
+
+static void pipeDrain(pipeWriter_t *p)
+{
+	recBuf_t *b;
+
+	while((b = recPop(&p->filled))) {
+		// After the reader went away everything is just handed back
+		if(!SDL_AtomicGet(&p->failed)) {
+			if(pipeWrite(p, b)) {
+				p->written++;
+			} else {
+				printf("Pipe %s was closed by the reader, stopped writing to it.\n", p->name);
+				SDL_AtomicSet(&p->failed, 1);
+			}
+		}
+		recPush(&p->free, b);
+		SDL_SemPost(p->space);
+	}
+	if(p->fp) {
+		fflush(p->fp);
+	}
+}
+
+static int pipeThread(void *ptr)
+{
+	pipeWriter_t *p = (pipeWriter_t*)ptr;
+
+	// Opening a named pipe waits for the reader, so it is done here
+	if(p->fd >= 0) {
+		p->fp = fdopen(p->fd, "wb");
+	} else {
+		p->fp = fopen(p->name, "wb");
+	}
+	if(!p->fp) {
+		printf("Error opening %s for writing.\n", p->name);
+		SDL_AtomicSet(&p->failed, 1);
+	} else if(!SDL_AtomicGet(&p->run)) {
+		// Only opened because stopPipe() stood in for the reader
+		SDL_AtomicSet(&p->failed, 1);
+	}
+	SDL_AtomicSet(&p->opened, 1);
+
+	while(SDL_AtomicGet(&p->run)) {
+		SDL_SemWaitTimeout(p->sem, SDLNET_STREAM_TIMEOUT);
+		pipeDrain(p);
+	}
+	// Nothing is queued after run is cleared
+	pipeDrain(p);
+
+	return 0;
+}
+
+// Depending on -e, waits for the reader or drops when it is too far behind
+static void pipeSubmit(programData *data, pipeWriter_t *p, const void *src, uint64_t seq, double time)
+{
+	recBuf_t *b = recPop(&p->free);
+
+	while(!b && data->pipeBlock && !SDL_AtomicGet(&p->failed)) {
+		SDL_SemWaitTimeout(p->space, SDLNET_STREAM_TIMEOUT);
+		b = recPop(&p->free);
+	}
+	if(unlikely(!b)) {
+		p->dropped++;
+		return;
+	}
+
+	if(p->kind == REC_VIDEO) {
+		memcpy(b->data, src, PACKED_FRAME_SIZE);
+		memcpy(b->pixMap, data->pixMap, NATIVE_PALETTE_SIZE * sizeof(uint64_t));
+		if(!p->started) {
+			p->period = data->clock.video.period;
+		}
+	} else {
+		memcpy(b->data, src, SAMPLE_SIZE);
+	}
+	b->seq = seq;
+	b->time = time;
+	recPush(&p->filled, b);
+	SDL_SemPost(p->sem);
+
+	if(unlikely(!p->started)) {
+		pipeWriter_t *v = &data->pipeVideo, *a = &data->pipeAudio;
+		p->started = 1;
+		p->start = time;
+		if(v->started && a->started) {
+			printf("Pipes: audio starts %.1f ms after video, give the audio input -itsoffset %.6f to keep them in sync.\n",
+				(a->start - v->start) * 1000.0, a->start - v->start);
+		}
+	}
+}
+
+void pipeFrame(programData *data, const uint8_t *packed, uint64_t frame, double time)
+{
+	pipeSubmit(data, &data->pipeVideo, packed, frame, time);
+}
+
+void pipeSamples(programData *data, const int16_t *block, uint64_t seq, double time)
+{
+	pipeSubmit(data, &data->pipeAudio, block, seq, time);
+}
+
+static void stopPipe(pipeWriter_t *p)
+{
+	if(p->thread) {
+		SDL_AtomicSet(&p->run, 0);
+		SDL_SemPost(p->sem);
+#ifndef _WIN32
+		// Nobody ever opened the other end of the pipe, do that so the thread gets out of fopen()
+		if(!SDL_AtomicGet(&p->opened)) {
+			int fd = open(p->name, O_RDONLY | O_NONBLOCK);
+			while(fd >= 0 && !SDL_AtomicGet(&p->opened)) {
+				SDL_Delay(1);
+			}
+			if(fd >= 0) {
+				close(fd);
+			}
+		}
+#endif
+		SDL_WaitThread(p->thread, NULL);
+		p->thread = NULL;
+		printf("Pipe %s: %"PRIu64" %s written, %"PRIu64" dropped because the reader was too slow.\n",
+			p->name, p->written, p->kind == REC_VIDEO ? "frames" : "audio blocks", p->dropped);
+	}
+	if(p->fp) {
+		fclose(p->fp);
+		p->fp = NULL;
+	} else if(p->fd >= 0) {
+		close(p->fd);
+	}
+	p->fd = -1;
+	if(p->sem) {
+		SDL_DestroySemaphore(p->sem);
+		p->sem = NULL;
+	}
+	if(p->space) {
+		SDL_DestroySemaphore(p->space);
+		p->space = NULL;
+	}
+	free(p->bufs);
+	free(p->pool);
+	free(p->out);
+	p->bufs = NULL;
+	p->pool = NULL;
+	p->out = NULL;
+}
+
+void stopPipes(programData *data)
+{
+	stopPipe(&data->pipeVideo);
+	stopPipe(&data->pipeAudio);
+}
+
+static int startPipe(programData *data, pipeWriter_t *p, recKind kind, const char *name, int count)
+{
+	size_t size = (kind == REC_VIDEO) ? PACKED_FRAME_SIZE + NATIVE_PALETTE_SIZE * sizeof(uint64_t) : SAMPLE_SIZE;
+
+	p->kind = kind;
+	p->count = count;
+	p->width = data->width;
+	p->height = data->height;
+	p->fd = -1;
+	if(!strcmp(name, "-")) {
+		p->name = "stdout";
+		p->fd = data->pipeStdout;
+		data->pipeStdout = -1;
+	} else {
+		p->name = name;
+	}
+	pipeSelectKernel(p);
+
+	p->bufs = calloc(count, sizeof(recBuf_t));
+	p->pool = malloc(count * size);
+	p->sem = SDL_CreateSemaphore(0);
+	p->space = SDL_CreateSemaphore(0);
+	if(kind == REC_VIDEO) {
+		p->out = malloc(sizeof(Y4M_FRAME_HEADER) - 1 + data->width * data->height * 3);
+		if(p->out) {
+			memcpy(p->out, Y4M_FRAME_HEADER, sizeof(Y4M_FRAME_HEADER) - 1);
+		}
+	}
+	if(!p->bufs || !p->pool || !p->sem || !p->space || (kind == REC_VIDEO && !p->out)) {
+		printf("Error: Could not allocate pipe buffers.\n");
+		return EXIT_FAILURE;
+	}
+	for(int i=0; i < count; i++) {
+		recBuf_t *b = &p->bufs[i];
+		b->kind = kind;
+		if(kind == REC_VIDEO) {
+			b->pixMap = (uint64_t*)(p->pool + i * size);
+			b->data = p->pool + i * size + NATIVE_PALETTE_SIZE * sizeof(uint64_t);
+		} else {
+			b->data = p->pool + i * size;
+		}
+		recPush(&p->free, b);
+	}
+
+	SDL_AtomicSet(&p->run, 1);
+	p->thread = SDL_CreateThread(pipeThread, kind == REC_VIDEO ? "pipevideo" : "pipeaudio", p);
+	if(!p->thread) {
+		printf("Error creating pipe thread: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int startPipes(programData *data)
+{
+#ifdef _WIN32
+	printf("Pipe output is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	// A reader going away should end the pipe, not u64view
+	signal(SIGPIPE, SIG_IGN);
+
+	if(strlen(data->pipeVideoName) && startPipe(data, &data->pipeVideo, REC_VIDEO, data->pipeVideoName, data->pipeFrames) != EXIT_SUCCESS) {
+		stopPipes(data);
+		return EXIT_FAILURE;
+	}
+	if(strlen(data->pipeAudioName) &&
+	   startPipe(data, &data->pipeAudio, REC_AUDIO, data->pipeAudioName, data->pipeFrames * PIPE_AUDIO_PER_FRAME) != EXIT_SUCCESS) {
+		stopPipes(data);
+		return EXIT_FAILURE;
+	}
+	if(data->pipeVideo.thread) {
+		printf("Writing Y4M video to %s (%s kernel)", data->pipeVideo.name, data->pipeVideo.kernelName);
+	}
+	if(data->pipeAudio.thread) {
+		printf("%s raw s16le audio at %i Hz to %s", data->pipeVideo.thread ? " and" : "Writing", U64_AUDIO_FREQUENCY, data->pipeAudio.name);
+	}
+	if(data->pipeBlock) {
+		printf(", waiting for the reader when it falls behind.\n");
+	} else {
+		printf(", dropping when the reader is %i frames behind.\n", data->pipeFrames);
+	}
+	return EXIT_SUCCESS;
+#endif
+}
+
+// Deflate with the fixed codes, LZ77 over hash chains does the work, C64 screens repeat a lot
+static const uint16_t deflateLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+	115, 131, 163, 195, 227, 258 };
+static const uint8_t deflateLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t deflateDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+	2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t deflateDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Huffman codes go out most significant bit first, everything else least significant first
+static inline void deflateCode(bitWriter_t *w, uint32_t code, int len)
+{
+	uint32_t rev = 0;
+
+	for(int b=0; b < len; b++) {
+		rev |= ((code >> b) & 1) << (len - 1 - b);
+	}
+	codecPutBits(w, rev, len);
+}
+
+static inline void deflateSymbol(bitWriter_t *w, int sym)
+{
+	if(sym < 144) {
+		deflateCode(w, 0x30 + sym, 8);
+	} else if(sym < 256) {
+		deflateCode(w, 0x190 + sym - 144, 9);
+	} else if(sym < 280) {
+		deflateCode(w, sym - 256, 7);
+	} else {
+		deflateCode(w, 0xc0 + sym - 280, 8);
+	}
+}
+
+static inline void deflateMatch(bitWriter_t *w, int len, int dist)
+{
+	int c = 28, d = 29;
+
+	while(deflateLengthBase[c] > len) {
+		c--;
+	}
+	deflateSymbol(w, 257 + c);
+	codecPutBits(w, len - deflateLengthBase[c], deflateLengthExtra[c]);
+	while(deflateDistBase[d] > dist) {
+		d--;
+	}
+	deflateCode(w, d, 5);
+	codecPutBits(w, dist - deflateDistBase[d], deflateDistExtra[d]);
+}
+
+static inline uint32_t deflateHash(const uint8_t *p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Returns the size, or 0 if it didn't fit
+static size_t deflateFixed(shots_t *sh, const uint8_t *in, size_t n, uint8_t *out, size_t size)
+{
+	bitWriter_t w = { out, 0, size, 0, 0 };
+	size_t i = 0;
+
+	for(int h=0; h < (1 << DEFLATE_HASH_BITS); h++) {
+		sh->head[h] = -1;
+	}
+	codecPutBits(&w, 3, 3); // The only block, fixed codes
+
+	while(i < n) {
+		int best = 0, dist = 0;
+		if(i + DEFLATE_MIN_MATCH <= n) {
+			uint32_t h = deflateHash(in + i);
+			int32_t cand = sh->head[h];
+			int max = (n - i < DEFLATE_MAX_MATCH) ? (int)(n - i) : DEFLATE_MAX_MATCH;
+			sh->prev[i & (DEFLATE_WINDOW - 1)] = cand;
+			sh->head[h] = (int32_t)i;
+			for(int chain=0; cand >= 0 && i - cand <= DEFLATE_WINDOW && chain < DEFLATE_MAX_CHAIN; chain++) {
+				int l = 0;
+				while(l < max && in[cand + l] == in[i + l]) {
+					l++;
+				}
+				if(l > best) {
+					best = l;
+					dist = (int)(i - cand);
+					if(l == max) {
+						break;
+					}
+				}
+				cand = sh->prev[cand & (DEFLATE_WINDOW - 1)];
+			}
+		}
+		if(best >= DEFLATE_MIN_MATCH) {
+			deflateMatch(&w, best, dist);
+			for(size_t j = i + 1; j < i + best && j + DEFLATE_MIN_MATCH <= n; j++) {
+				uint32_t h = deflateHash(in + j);
+				sh->prev[j & (DEFLATE_WINDOW - 1)] = sh->head[h];
+				sh->head[h] = (int32_t)j;
+			}
+			i += best;
+		} else {
+			deflateSymbol(&w, in[i]);
+			i++;
+		}
+	}
+	deflateSymbol(&w, 256);
+	if(w.bits) {
+		codecPutBits(&w, 0, 8 - w.bits);
+	}
+	return (w.pos <= size) ? w.pos : 0;
+}
+
+static uint32_t pngCrc(shots_t *sh, uint32_t crc, const uint8_t *p, size_t n)
+{
+	for(size_t i=0; i < n; i++) {
+		crc = sh->crc[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static inline void pngPut32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static int pngChunk(shots_t *sh, FILE *fp, const char *type, const uint8_t *payload, uint32_t len)
+{
+	uint8_t head[8], tail[4];
+
+	pngPut32(head, len);
+	memcpy(head + 4, type, 4);
+	pngPut32(tail, ~pngCrc(sh, pngCrc(sh, 0xffffffff, head + 4, 4), payload, len));
+	return fwrite(head, sizeof(head), 1, fp) == 1 && (!len || fwrite(payload, len, 1, fp) == 1) && fwrite(tail, sizeof(tail), 1, fp) == 1;
+}
+
+// 4 bit palettized, so the packed frame only needs its nibbles swapped and a filter byte in front of each row
+static int writePng(shots_t *sh, const char *fn, const uint8_t *packed, const uint64_t *pixMap)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	int stride = sh->width / 2;
+	size_t rawSize = (size_t)(stride + 1) * sh->height, size;
+	uint8_t ihdr[13] = { 0 }, plte[NATIVE_PALETTE_SIZE * 3];
+	uint32_t a = 1, b = 0;
+	FILE *fp;
+	int ok;
+
+	for(int y=0; y < sh->height; y++) {
+		uint8_t *row = sh->raw + (size_t)y * (stride + 1);
+		row[0] = 0;
+		for(int x=0; x < stride; x++) {
+			uint8_t p = packed[y * stride + x];
+			row[x + 1] = (uint8_t)(p << 4 | p >> 4);
+		}
+	}
+	// zlib around the deflate data
+	sh->out[0] = 0x78;
+	sh->out[1] = 0x01;
+	size = deflateFixed(sh, sh->raw, rawSize, sh->out + 2, rawSize + rawSize / 8 + 64);
+	if(!size) {
+		return EXIT_FAILURE;
+	}
+	for(size_t i=0; i < rawSize; i++) {
+		a = (a + sh->raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	pngPut32(sh->out + 2 + size, b << 16 | a);
+
+	pngPut32(ihdr, sh->width);
+	pngPut32(ihdr + 4, sh->height);
+	ihdr[8] = 4; // Bit depth
+	ihdr[9] = 3; // Palette
+	for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+		uint32_t c = (uint32_t)pixMap[i];
+		plte[i * 3] = c >> 24;
+		plte[i * 3 + 1] = (c >> 16) & 0xff;
+		plte[i * 3 + 2] = (c >> 8) & 0xff;
+	}
+
+	if(!(fp = fopen(fn, "wb"))) {
+		return EXIT_FAILURE;
+	}
+	ok = fwrite(signature, sizeof(signature), 1, fp) == 1 &&
+		pngChunk(sh, fp, "IHDR", ihdr, sizeof(ihdr)) &&
+		pngChunk(sh, fp, "PLTE", plte, sizeof(plte)) &&
+		pngChunk(sh, fp, "IDAT", sh->out, size + 6) &&
+		pngChunk(sh, fp, "IEND", NULL, 0);
+	ok &= (fclose(fp) == 0);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Numbers that are taken are skipped, so earlier screenshots are never overwritten
+static void shotName(shots_t *sh, char *fn, size_t size)
+{
+	FILE *fp;
+
+	for(;;) {
+		snprintf(fn, size, "%s-%04i.png", sh->name, sh->number);
+		if(!(fp = fopen(fn, "rb"))) {
+			return;
+		}
+		fclose(fp);
+		sh->number++;
+	}
+}
+
+static int shotThread(void *ptr)
+{
+	shots_t *sh = (shots_t*)ptr;
+	char fn[MAX_STRING_SIZE + 16];
+	recBuf_t *b;
+
+	while(SDL_AtomicGet(&sh->run) || SDL_AtomicGet(&sh->busy)) {
+		SDL_SemWaitTimeout(sh->sem, SDLNET_STREAM_TIMEOUT);
+		while((b = recPop(&sh->filled))) {
+			shotName(sh, fn, sizeof(fn));
+			if(writePng(sh, fn, b->data, b->pixMap) != EXIT_SUCCESS) {
+				printf("Error writing screenshot %s.\n", fn);
+			}
+			if(sh->burstFirst < 0) {
+				sh->burstFirst = sh->number;
+			}
+			// seq counts down the frames still to come in the burst
+			if(b->seq == 0) {
+				if(sh->burstFirst == sh->number) {
+					printf("Screenshot saved to %s.\n", fn);
+				} else {
+					printf("Burst of %i screenshots saved, %s-%04i.png to %s.\n", sh->number - sh->burstFirst + 1, sh->name, sh->burstFirst, fn);
+				}
+				sh->burstFirst = -1;
+			}
+			sh->number++;
+			recPush(&sh->free, b);
+			SDL_AtomicAdd(&sh->busy, -1);
+		}
+	}
+
+	return 0;
+}
+
+// Takes the next frames shown, the buffers are all free again by the time a new one can start
+void shotStart(programData *data, int frames)
+{
+	shots_t *sh = &data->shots;
+
+	if(!sh->thread) {
+		return;
+	}
+	if(strlen(data->playName) ? !data->play.native : !data->fast) {
+		printf("Screenshots only work with the default drawing method and with .u64 recordings.\n");
+		return;
+	}
+	if(sh->pending || SDL_AtomicGet(&sh->busy)) {
+		printf("Still saving the last screenshots.\n");
+		return;
+	}
+	sh->pending = frames;
+}
+
+void shotSubmit(programData *data, const uint8_t *packed, const uint32_t *palette)
+{
+	shots_t *sh = &data->shots;
+	recBuf_t *b = recPop(&sh->free);
+
+	if(unlikely(!b)) {
+		return;
+	}
+	memcpy(b->data, packed, PACKED_FRAME_SIZE);
+	for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+		b->pixMap[i] = palette[i];
+	}
+	b->seq = --sh->pending;
+	SDL_AtomicAdd(&sh->busy, 1);
+	recPush(&sh->filled, b);
+	SDL_SemPost(sh->sem);
+}
+
+// What is on screen, which is from the instant replay when time shifting
+static void shotLive(programData *data)
+{
+	history_t *h = &data->history;
+	uint32_t palette[NATIVE_PALETTE_SIZE];
+
+	if(data->timeShift.active) {
+		int slot = data->timeShift.frame % h->frameSlots;
+		shotSubmit(data, h->frames + (size_t)slot * PACKED_FRAME_SIZE, h->palettes + slot * NATIVE_PALETTE_SIZE);
+	} else {
+		pixMapPalette(data->pixMap, palette);
+		shotSubmit(data, data->clock.shownFrame, palette);
+	}
+}
+
+void stopShots(programData *data)
+{
+	shots_t *sh = &data->shots;
+
+	if(sh->thread) {
+		SDL_AtomicSet(&sh->run, 0);
+		SDL_SemPost(sh->sem);
+		SDL_WaitThread(sh->thread, NULL);
+		sh->thread = NULL;
+	}
+	if(sh->sem) {
+		SDL_DestroySemaphore(sh->sem);
+		sh->sem = NULL;
+	}
+	free(sh->bufs);
+	free(sh->pool);
+	free(sh->raw);
+	free(sh->out);
+	free(sh->head);
+	free(sh->prev);
+	sh->bufs = NULL;
+	sh->pool = NULL;
+	sh->raw = NULL;
+	sh->out = NULL;
+	sh->head = NULL;
+	sh->prev = NULL;
+}
+
+// Everything a burst and the encoder need is allocated here, taking a screenshot only copies the frame
+int startShots(programData *data)
+{
+	shots_t *sh = &data->shots;
+	size_t size = PACKED_FRAME_SIZE + NATIVE_PALETTE_SIZE * sizeof(uint64_t);
+	size_t rawSize = (size_t)(data->width / 2 + 1) * data->height;
+
+	sh->width = data->width;
+	sh->height = data->height;
+	sh->number = 1;
+	sh->burstFirst = -1;
+	sh->bufs = calloc(sh->count, sizeof(recBuf_t));
+	sh->pool = malloc(sh->count * size);
+	sh->raw = malloc(rawSize);
+	sh->out = malloc(rawSize + rawSize / 8 + 64 + 6);
+	sh->head = malloc((1 << DEFLATE_HASH_BITS) * sizeof(int32_t));
+	sh->prev = malloc(DEFLATE_WINDOW * sizeof(int32_t));
+	sh->sem = SDL_CreateSemaphore(0);
+	if(!sh->bufs || !sh->pool || !sh->raw || !sh->out || !sh->head || !sh->prev || !sh->sem) {
+		printf("Error: Could not allocate screenshot buffers.\n");
+		stopShots(data);
+		return EXIT_FAILURE;
+	}
+	for(int i=0; i < sh->count; i++) {
+		recBuf_t *b = &sh->bufs[i];
+		b->kind = REC_VIDEO;
+		b->pixMap = (uint64_t*)(sh->pool + i * size);
+		b->data = sh->pool + i * size + NATIVE_PALETTE_SIZE * sizeof(uint64_t);
+		recPush(&sh->free, b);
+	}
+	for(uint32_t i=0; i < 256; i++) {
+		uint32_t c = i;
+		for(int k=0; k < 8; k++) {
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		sh->crc[i] = c;
+	}
+
+	SDL_AtomicSet(&sh->run, 1);
+	sh->thread = SDL_CreateThread(shotThread, "screenshots", sh);
+	if(!sh->thread) {
+		printf("Error creating screenshot thread: %s\n", SDL_GetError());
+		stopShots(data);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Instant replay, the last few seconds of what was shown and heard, kept in memory so it can be saved after the fact
+static inline int historyBlocked(uint64_t oldest, uint64_t start, uint64_t end, SDL_atomic_t *done)
+{
+	// The slot about to be reused holds something the dump still has to write
+	return oldest >= start + (uint64_t)SDL_AtomicGet(done) && oldest < end;
+}
+
+void historyFrame(programData *data, const uint8_t *packed, uint64_t seq, double time)
+{
+	history_t *h = &data->history;
+	int slot = h->frameCount % h->frameSlots;
+
+	if(unlikely(SDL_AtomicGet(&h->dumping) && h->frameCount >= (uint64_t)h->frameSlots &&
+	   historyBlocked(h->frameCount - h->frameSlots, h->dumpFrameStart, h->dumpFrameEnd, &h->dumpFrameDone))) {
+		h->skippedFrames++;
+		return;
+	}
+
+	memcpy(h->frames + (size_t)slot * PACKED_FRAME_SIZE, packed, PACKED_FRAME_SIZE);
+	pixMapPalette(data->pixMap, h->palettes + slot * NATIVE_PALETTE_SIZE);
+	h->frameSeq[slot] = seq;
+	h->frameTime[slot] = time;
+	h->frameCount++;
+}
+
+void historyAudio(programData *data, const int16_t *block, uint64_t seq, double time)
+{
+	history_t *h = &data->history;
+	int slot = h->blockCount % h->blockSlots;
+
+	if(unlikely(SDL_AtomicGet(&h->dumping) && h->blockCount >= (uint64_t)h->blockSlots &&
+	   historyBlocked(h->blockCount - h->blockSlots, h->dumpBlockStart, h->dumpBlockEnd, &h->dumpBlockDone))) {
+		h->skippedBlocks++;
+		return;
+	}
+
+	memcpy(h->blocks + (size_t)slot * SAMPLE_SIZE / sizeof(int16_t), block, SAMPLE_SIZE);
+	h->blockSeq[slot] = seq;
+	h->blockTime[slot] = time;
+	h->blockCount++;
+}
+
+// Writes the frozen range oldest first, the live side only waits for the slots it wants to reuse
+static int historyDumpThread(void *ptr)
+{
+	programData *data = (programData*)ptr;
+	history_t *h = &data->history;
+	nativeWriter_t w;
+	uint64_t f = h->dumpFrameStart;
+	uint64_t a = h->dumpBlockStart;
+	size_t written = 1;
+	FILE *fp = fopen(h->dumpName, "wb");
+
+	if(!fp || nativeWriterInit(&w, fp) != EXIT_SUCCESS) {
+		printf("Error opening %s for writing.\n", h->dumpName);
+		if(fp) {
+			fclose(fp);
+		}
+		SDL_AtomicSet(&h->dumping, 0);
+		return 0;
+	}
+	writeNativeHeader(&w, data);
+
+	while(written && (f < h->dumpFrameEnd || a < h->dumpBlockEnd)) {
+		int fs = f % h->frameSlots;
+		int as = a % h->blockSlots;
+		if(f < h->dumpFrameEnd && (a == h->dumpBlockEnd || h->frameTime[fs] <= h->blockTime[as])) {
+			written = writeNativeFrame(&w, h->frames + (size_t)fs * PACKED_FRAME_SIZE, h->palettes + fs * NATIVE_PALETTE_SIZE, h->frameSeq[fs], h->frameTime[fs]);
+			f++;
+			SDL_AtomicAdd(&h->dumpFrameDone, 1);
+		} else {
+			written = writeNativeAudio(&w, h->blocks + (size_t)as * SAMPLE_SIZE / sizeof(int16_t), h->blockSeq[as], h->blockTime[as]);
+			a++;
+			SDL_AtomicAdd(&h->dumpBlockDone, 1);
+		}
+	}
+
+	writeNativeHeader(&w, data);
+	if(fclose(fp) != 0 || !written) {
+		printf("Error writing %s, is the disk full?\n", h->dumpName);
+	} else {
+		printf("Saved the last %.1f seconds to %s (%"PRIu64" frames, %"PRIu64" audio blocks), expand it with -X.\n",
+			w.frames * data->clock.video.period, h->dumpName, w.frames, w.blocks);
+	}
+	nativeWriterFree(&w);
+	SDL_AtomicSet(&h->dumping, 0);
+
+	return 0;
+}
+
+void dumpHistory(programData *data)
+{
+	history_t *h = &data->history;
+	time_t now = time(NULL);
+
+	if(!h->frames) {
+		printf("Start with -H N to keep the last N seconds for instant replay.\n");
+		return;
+	}
+	if(SDL_AtomicGet(&h->dumping)) {
+		printf("Still saving the last instant replay.\n");
+		return;
+	}
+	if(h->thread) {
+		SDL_WaitThread(h->thread, NULL);
+		h->thread = NULL;
+	}
+
+	// The ring is sized for NTSC, a PAL stream only saves the seconds asked for
+	uint64_t keep = h->seconds / data->clock.video.period + 1;
+	if(keep > (uint64_t)h->frameSlots) {
+		keep = h->frameSlots;
+	}
+	h->dumpFrameEnd = h->frameCount;
+	h->dumpFrameStart = (h->frameCount > keep) ? h->frameCount - keep : 0;
+	h->dumpBlockEnd = h->blockCount;
+	h->dumpBlockStart = (h->blockCount > (uint64_t)h->blockSlots) ? h->blockCount - h->blockSlots : 0;
+	SDL_AtomicSet(&h->dumpFrameDone, 0);
+	SDL_AtomicSet(&h->dumpBlockDone, 0);
+	strftime(h->dumpName, sizeof(h->dumpName), "u64view-%Y%m%d-%H%M%S.u64", localtime(&now));
+
+	SDL_AtomicSet(&h->dumping, 1);
+	h->thread = SDL_CreateThread(historyDumpThread, "replaydump", data);
+	if(!h->thread) {
+		printf("Error creating instant replay thread: %s\n", SDL_GetError());
+		SDL_AtomicSet(&h->dumping, 0);
+	}
+}
+
+void stopHistory(programData *data)
+{
+	history_t *h = &data->history;
+
+	if(h->thread) {
+		SDL_WaitThread(h->thread, NULL);
+		h->thread = NULL;
+	}
+	if(data->verbose && (h->skippedFrames || h->skippedBlocks)) {
+		printf("Instant replay: %"PRIu64" frames and %"PRIu64" audio blocks not kept while saving.\n", h->skippedFrames, h->skippedBlocks);
+	}
+	free(h->frames);
+	free(h->palettes);
+	free(h->frameSeq);
+	free(h->frameTime);
+	free(h->blocks);
+	free(h->blockSeq);
+	free(h->blockTime);
+	h->frames = NULL;
+	h->palettes = NULL;
+	h->frameSeq = NULL;
+	h->frameTime = NULL;
+	h->blocks = NULL;
+	h->blockSeq = NULL;
+	h->blockTime = NULL;
+}
+
+// Everything is allocated up front and touched once, so the memory is really there before it's needed
+int startHistory(programData *data)
+{
+	history_t *h = &data->history;
+
+	// Sized for the faster NTSC frame rate, so a PAL stream gets a bit more than asked for
+	h->frameSlots = h->seconds / NTSC_FRAME_PERIOD + 1;
+	h->blockSlots = h->seconds * U64_AUDIO_FREQUENCY / AUDIO_SAMPLES + 1;
+	h->frames = calloc(h->frameSlots, PACKED_FRAME_SIZE);
+	h->palettes = calloc(h->frameSlots, NATIVE_PALETTE_SIZE * sizeof(uint32_t));
+	h->frameSeq = calloc(h->frameSlots, sizeof(uint64_t));
+	h->frameTime = calloc(h->frameSlots, sizeof(double));
+	h->blocks = calloc(h->blockSlots, SAMPLE_SIZE);
+	h->blockSeq = calloc(h->blockSlots, sizeof(uint64_t));
+	h->blockTime = calloc(h->blockSlots, sizeof(double));
+	if(!h->frames || !h->palettes || !h->frameSeq || !h->frameTime || !h->blocks || !h->blockSeq || !h->blockTime) {
+		printf("Error: Could not allocate %i seconds of instant replay.\n", h->seconds);
+		stopHistory(data);
+		return EXIT_FAILURE;
+	}
+	memset(h->frames, 0, (size_t)h->frameSlots * PACKED_FRAME_SIZE);
+	memset(h->blocks, 0, (size_t)h->blockSlots * SAMPLE_SIZE);
+
+	printf("Keeping the last %i seconds for instant replay (%.1f MiB), press i to save them.\n", h->seconds,
+		((double)h->frameSlots * PACKED_FRAME_SIZE + (double)h->blockSlots * SAMPLE_SIZE) / (1024 * 1024));
+	return EXIT_SUCCESS;
+}
+
+// Time-shift, show frames from the instant replay ring while the live stream keeps coming in behind it
+static inline uint64_t historyOldest(uint64_t count, int slots)
+{
+	return (count > (uint64_t)slots) ? count - slots : 0;
+}
+
+// First block in the ring that is heard at or after the given stream time
+static uint64_t historyBlockAt(history_t *h, double time)
+{
+	uint64_t lo = historyOldest(h->blockCount, h->blockSlots);
+	uint64_t hi = h->blockCount;
+
+	while(lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if(h->blockTime[mid % h->blockSlots] < time) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Line the audio up with the frame, the same distance apart as the live frame and the audio being queued now
+static void timeShiftSeekAudio(programData *data)
+{
+	history_t *h = &data->history;
+	timeShift_t *ts = &data->timeShift;
+	streamClock_t *sc = &data->clock;
+	double ahead = clockTime(&sc->audio, sc->audioBlocks) - (clockTime(&sc->video, sc->shownUnit) - sc->video.period);
+
+	ts->block = historyBlockAt(h, h->frameTime[ts->frame % h->frameSlots] + ahead);
+}
+
+static void timeShiftLive(programData *data)
+{
+	data->timeShift.active = 0;
+	data->timeShift.paused = 0;
+	printf("Time-shift: back to live.\n");
+}
+
+// Returns 1 if the picture needs to be drawn again
+int timeShiftKey(programData *data, SDL_Keycode key)
+{
+	history_t *h = &data->history;
+	timeShift_t *ts = &data->timeShift;
+	int64_t step = 0;
+
+	if(!h->frames || !data->fast || h->frameCount == 0) {
+		printf("Time-shift needs -H N and the default drawing method.\n");
+		return 0;
+	}
+
+	if(!ts->active) {
+		if(key == SDLK_l) {
+			return 0;
+		}
+		ts->active = 1;
+		ts->paused = 1;
+		ts->frame = h->frameCount - 1;
+		if(key == SDLK_SPACE) {
+			printf("Time-shift: paused, the stream keeps being received.\n");
+			return 1;
+		}
+	}
+
+	// Paused for longer than -H, the frame it stopped on has been overwritten since
+	uint64_t oldest = historyOldest(h->frameCount, h->frameSlots);
+	if(ts->frame < oldest) {
+		ts->frame = oldest;
+	}
+
+	switch(key) {
+		case SDLK_SPACE:
+			ts->paused = !ts->paused;
+			break;
+		case SDLK_LEFT:
+			ts->paused = 1;
+			step = -1;
+			break;
+		case SDLK_RIGHT:
+			ts->paused = 1;
+			step = 1;
+			break;
+		case SDLK_PAGEUP:
+			step = -TIMESHIFT_JUMP / data->clock.video.period;
+			break;
+		case SDLK_PAGEDOWN:
+			step = TIMESHIFT_JUMP / data->clock.video.period;
+			break;
+		case SDLK_l:
+			timeShiftLive(data);
+			return 1;
+	}
+
+	if(step < 0 && ts->frame - oldest < (uint64_t)-step) {
+		ts->frame = oldest;
+	} else if(step > 0 && ts->frame + step >= h->frameCount) {
+		if(!ts->paused) {
+			timeShiftLive(data);
+			return 1;
+		}
+		ts->frame = h->frameCount - 1;
+	} else {
+		ts->frame += step;
+	}
+
+	if(!ts->paused) {
+		timeShiftSeekAudio(data);
+	}
+	return 1;
+}
+
+// Some live frames went by, play on as many if not paused
+static inline void timeShiftAdvance(programData *data, int frames)
+{
+	timeShift_t *ts = &data->timeShift;
+
+	if(!ts->paused && data->history.frameCount) {
+		ts->frame += frames;
+		if(ts->frame > data->history.frameCount - 1) {
+			ts->frame = data->history.frameCount - 1;
+		}
+	}
+}
+
+void timeShiftShow(programData *data)
+{
+	history_t *h = &data->history;
+	timeShift_t *ts = &data->timeShift;
+	uint64_t pixMap[PIXMAP_SIZE];
+
+	// Paused longer than the ring is long, hang on to the oldest there is
+	uint64_t oldest = historyOldest(h->frameCount, h->frameSlots);
+	if(unlikely(ts->frame < oldest)) {
+		ts->frame = oldest;
+	}
+
+	int slot = ts->frame % h->frameSlots;
+	paletteToPixMap(h->palettes + slot * NATIVE_PALETTE_SIZE, pixMap);
+	expandPacked(h->frames + (size_t)slot * PACKED_FRAME_SIZE, pixMap, data->pixels, data->width, data->height, data->pitch / 8);
+}
+
+// What to play instead of the live block, silence while paused
+static inline const int16_t *timeShiftAudio(programData *data)
+{
+	static const int16_t silence[SAMPLE_SIZE / 2];
+	history_t *h = &data->history;
+	timeShift_t *ts = &data->timeShift;
+
+	if(ts->paused || ts->block < historyOldest(h->blockCount, h->blockSlots) || ts->block >= h->blockCount) {
+		return silence;
+	}
+	return h->blocks + (size_t)(ts->block++ % h->blockSlots) * SAMPLE_SIZE / sizeof(int16_t);
+}
+
+// Expand a native recording to the .rgb/.pcm/.sync files -o would have written
+// Name and extension in fnbuf, a name that doesn't fit would be a different file so that fails
+static int extName(programData *data, const char *name, const char *ext)
+{
+	if(snprintf(data->fnbuf, sizeof(data->fnbuf), "%s%s", name, ext) >= (int)sizeof(data->fnbuf)) {
+		printf("Error: File name %s%s is too long.\n", name, ext);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int exportRecording(programData *data)
+{
+	const char *name = data->exportName;
+	nativeHeader_t h;
+	nativeChunk_t c;
+	FILE *in = NULL, *vfp = NULL, *afp = NULL;
+	uint8_t *packed = malloc(PACKED_FRAME_SIZE);
+	uint8_t *coded = malloc(PACKED_FRAME_SIZE);
+	uint32_t *argb = NULL;
+	uint64_t pixMap[PIXMAP_SIZE];
+	int16_t block[SAMPLE_SIZE / 2];
+	uint64_t frames = 0, repeated = 0, blocks = 0, silenced = 0;
+	uint64_t lastFrame = 0, lastBlock = 0;
+	double videoStart = 0, audioStart = 0;
+	int havePalette = 0;
+	int result = EXIT_FAILURE;
+
+	if(extName(data, name, ".u64") != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	in = fopen(data->fnbuf, "rb");
+	if(!in) {
+		printf("Error opening %s for reading.\n", data->fnbuf);
+		goto clean_up;
+	}
+	if(fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, NATIVE_MAGIC, sizeof(h.magic)) || h.version > NATIVE_VERSION ||
+	   h.audioBlockSize != SAMPLE_SIZE || (size_t)h.width * h.height / 2 != PACKED_FRAME_SIZE) {
+		printf("Error: %s is not a u64view recording this version can read.\n", data->fnbuf);
+		goto clean_up;
+	}
+
+	argb = malloc(sizeof(uint32_t) * h.width * h.height);
+	if(!packed || !coded || !argb) {
+		printf("Error: Out of memory.\n");
+		goto clean_up;
+	}
+
+	if(extName(data, name, ".rgb") != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	vfp = fopen(data->fnbuf, "w");
+	if(extName(data, name, ".pcm") != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	afp = fopen(data->fnbuf, "w");
+	if(!vfp || !afp) {
+		printf("Error opening %s.rgb and %s.pcm for writing.\n", name, name);
+		goto clean_up;
+	}
+
+	while(fread(&c, sizeof(c), 1, in) == 1) {
+		switch(c.type) {
+			case NATIVE_PALETTE: {
+				uint32_t palette[NATIVE_PALETTE_SIZE];
+				if(c.size != sizeof(palette) || fread(palette, sizeof(palette), 1, in) != 1) {
+					goto truncated;
+				}
+				paletteToPixMap(palette, pixMap);
+				havePalette = 1;
+				break;
+			}
+			case NATIVE_VIDEO:
+			case NATIVE_VIDEO_KEY:
+			case NATIVE_VIDEO_DELTA:
+			case NATIVE_VIDEO_REPEAT:
+				if(c.size > PACKED_FRAME_SIZE || !havePalette || ((c.type == NATIVE_VIDEO_DELTA || c.type == NATIVE_VIDEO_REPEAT) && !frames)) {
+					goto truncated;
+				}
+				// Frames the recorder had to drop are filled in with the one before, so the frame rate stays constant
+				if(frames && c.seq - lastFrame > 1 && c.seq - lastFrame <= NATIVE_MAX_REPEAT) {
+					for(uint64_t i=1; i < c.seq - lastFrame; i++) {
+						fwrite(argb, sizeof(uint32_t) * h.width * h.height, 1, vfp);
+						repeated++;
+					}
+				}
+				if((c.size && fread(coded, c.size, 1, in) != 1) || decodeNativeFrame(c.type, coded, c.size, packed) != EXIT_SUCCESS) {
+					goto truncated;
+				}
+				if(!frames) {
+					videoStart = c.time;
+				}
+				expandPacked(packed, pixMap, argb, h.width, h.height, h.width / 2);
+				if(fwrite(argb, sizeof(uint32_t) * h.width * h.height, 1, vfp) != 1) {
+					printf("Error writing %s.rgb.\n", name);
+					goto clean_up;
+				}
+				lastFrame = c.seq;
+				frames++;
+				break;
+			case NATIVE_AUDIO:
+				if(c.size != SAMPLE_SIZE) {
+					goto truncated;
+				}
+				// Same for audio, with silence
+				if(blocks && c.seq - lastBlock > 1 && c.seq - lastBlock <= NATIVE_MAX_REPEAT) {
+					memset(block, 0, sizeof(block));
+					for(uint64_t i=1; i < c.seq - lastBlock; i++) {
+						fwrite(block, SAMPLE_SIZE, 1, afp);
+						silenced++;
+					}
+				}
+				if(fread(block, SAMPLE_SIZE, 1, in) != 1) {
+					goto truncated;
+				}
+				if(!blocks) {
+					audioStart = c.time;
+				}
+				if(fwrite(block, SAMPLE_SIZE, 1, afp) != 1) {
+					printf("Error writing %s.pcm.\n", name);
+					goto clean_up;
+				}
+				lastBlock = c.seq;
+				blocks++;
+				break;
+			default:
+				// Skip what a later version may add
+				if(fseek(in, c.size, SEEK_CUR) != 0) {
+					goto truncated;
+				}
+				break;
+		}
+	}
+
+	if(0) {
+truncated:
+		printf("Warning: %s.u64 is truncated or damaged, exported what could be read.\n", name);
+	}
+
+	printf("Exported %"PRIu64" frames (%"PRIu64" repeated for dropped ones) and %"PRIu64" audio blocks (%"PRIu64" silent) to %s.rgb and %s.pcm.\n",
+		frames + repeated, repeated, blocks + silenced, silenced, name, name);
+	if(frames && blocks) {
+		writeSyncFile(name, h.framePeriod, videoStart, audioStart);
+	}
+	result = EXIT_SUCCESS;
+
+clean_up:
+	if(in) {
+		fclose(in);
+	}
+	if(vfp) {
+		fclose(vfp);
+	}
+	if(afp) {
+		fclose(afp);
+	}
+	free(packed);
+	free(coded);
+	free(argb);
+
+	return result;
+}
+
+// Codes the frames of a recording again and decodes them, to see how well and how fast the codec does on real content
+int codecBench(programData *data)
+{
+	const char *name = data->codecBenchName;
+	nativeHeader_t h;
+	nativeChunk_t c;
+	frameCodec_t codec;
+	FILE *in = NULL;
+	uint8_t *frames = malloc((size_t)CODEC_BENCH_FRAMES * PACKED_FRAME_SIZE);
+	uint8_t *coded = malloc((size_t)CODEC_BENCH_FRAMES * PACKED_FRAME_SIZE);
+	uint8_t *buf = malloc(PACKED_FRAME_SIZE);
+	uint8_t *frame = malloc(PACKED_FRAME_SIZE);
+	uint32_t *sizes = malloc(CODEC_BENCH_FRAMES * sizeof(uint32_t));
+	int n = 0;
+	int result = EXIT_FAILURE;
+
+	// clean_up frees it even when a malloc above failed and codecInit() never ran
+	memset(&codec, 0, sizeof(codec));
+	if(!frames || !coded || !buf || !frame || !sizes || codecInit(&codec) != EXIT_SUCCESS) {
+		printf("Error: Out of memory.\n");
+		goto clean_up;
+	}
+
+	if(extName(data, name, ".u64") != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	in = fopen(data->fnbuf, "rb");
+	if(!in || fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, NATIVE_MAGIC, sizeof(h.magic)) || h.version > NATIVE_VERSION) {
+		printf("Error: Could not read a u64view recording from %s.\n", data->fnbuf);
+		goto clean_up;
+	}
+
+	while(n < CODEC_BENCH_FRAMES && fread(&c, sizeof(c), 1, in) == 1) {
+		if(c.type != NATIVE_VIDEO && c.type != NATIVE_VIDEO_KEY && c.type != NATIVE_VIDEO_DELTA && c.type != NATIVE_VIDEO_REPEAT) {
+			if(fseek(in, c.size, SEEK_CUR) != 0) {
+				break;
+			}
+			continue;
+		}
+		if(c.size > PACKED_FRAME_SIZE || (c.size && fread(buf, c.size, 1, in) != 1) ||
+		   ((c.type == NATIVE_VIDEO_DELTA || c.type == NATIVE_VIDEO_REPEAT) && !n) || decodeNativeFrame(c.type, buf, c.size, frame) != EXIT_SUCCESS) {
+			break;
+		}
+		memcpy(frames + (size_t)n * PACKED_FRAME_SIZE, frame, PACKED_FRAME_SIZE);
+		n++;
+	}
+	if(!n) {
+		printf("Error: No frames in %s.\n", data->fnbuf);
+		goto clean_up;
+	}
+
+	uint64_t total = 0;
+	uint64_t start = SDL_GetPerformanceCounter();
+	for(int i=0; i < n; i++) {
+		uint8_t *out = coded + total;
+		sizes[i] = codecEncode(&codec, frames + (size_t)i * PACKED_FRAME_SIZE, i % NATIVE_KEYFRAME_INTERVAL == 0, out);
+		if(!sizes[i]) {
+			memcpy(out, frames + (size_t)i * PACKED_FRAME_SIZE, PACKED_FRAME_SIZE);
+			sizes[i] = PACKED_FRAME_SIZE;
+		}
+		total += sizes[i];
+	}
+	double encSec = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	double decSec = 0;
+	uint64_t pos = 0;
+	int bad = 0;
+	for(int i=0; i < n; i++) {
+		uint32_t type = (sizes[i] == PACKED_FRAME_SIZE) ? NATIVE_VIDEO : (i % NATIVE_KEYFRAME_INTERVAL == 0) ? NATIVE_VIDEO_KEY : NATIVE_VIDEO_DELTA;
+		start = SDL_GetPerformanceCounter();
+		int r = decodeNativeFrame(type, coded + pos, sizes[i], frame);
+		decSec += (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		if(r != EXIT_SUCCESS || memcmp(frame, frames + (size_t)i * PACKED_FRAME_SIZE, PACKED_FRAME_SIZE)) {
+			bad++;
+		}
+		pos += sizes[i];
+	}
+
+	double mb = (double)n * PACKED_FRAME_SIZE / 1e6;
+	printf("Codec on %i frames of %s, keyframe every %i:\n", n, data->fnbuf, NATIVE_KEYFRAME_INTERVAL);
+	printf("  Size:   %"PRIu64" bytes, %.1fx smaller than packed, %.1fx smaller than .rgb, %.1f KiB/s at 50 fps.\n",
+		total, mb * 1e6 / total, mb * 8e6 / total, total / (n / 50.0) / 1024);
+	printf("  Encode: %8.1f MB/s, %7.0f fps (%.0fx realtime).\n", mb / encSec, n / encSec, n / encSec / 50);
+	printf("  Decode: %8.1f MB/s, %7.0f fps (%.0fx realtime).\n", mb / decSec, n / decSec, n / decSec / 50);
+
+	result = EXIT_SUCCESS;
+	if(bad) {
+		printf("  Error: %i frames did not decode to what was coded.\n", bad);
+		result = EXIT_FAILURE;
+	}
+	if(n / encSec < 50 || n / decSec < 500) {
+		printf("  Error: Too slow, coding needs to keep up with 50 fps and playback wants 10x that.\n");
+		result = EXIT_FAILURE;
+	}
+
+clean_up:
+	if(in) {
+		fclose(in);
+	}
+	codecFree(&codec);
+	free(frames);
+	free(coded);
+	free(buf);
+	free(frame);
+	free(sizes);
+
+	return result;
+}
+
+// Repeat the last block a little quieter, fading in from its last frame so the seam doesn't click
+static void plcSynth(plc_t *p, int16_t *out)
+{
+	const int16_t *hold = &p->last[(AUDIO_SAMPLES - 1) * AUDIO_CHANNELS];
+
+	for(int i=0; i < AUDIO_SAMPLES; i++) {
+		for(int c=0; c < AUDIO_CHANNELS; c++) {
+			float v = p->last[i * AUDIO_CHANNELS + c] * PLC_FADE;
+			if(i < PLC_XFADE) {
+				float w = (float)(i + 1) / (PLC_XFADE + 1);
+				v = hold[c] * (1.0f - w) + v * w;
+			}
+			out[i * AUDIO_CHANNELS + c] = (int16_t)v;
+		}
+	}
+}
+
+static inline void outputAudio(programData *data, const int16_t *block)
+{
+	streamClock_t *sc = &data->clock;
+
+	if(unlikely(data->rec.thread && SDL_AtomicGet(&data->rec.active) && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
+		recordAudio(data, block, sc->audioBlocks, clockTime(&sc->audio, sc->audioBlocks));
+	}
+	if(unlikely(data->pipeAudio.thread && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
+		pipeSamples(data, block, sc->audioBlocks, clockTime(&sc->audio, sc->audioBlocks));
+	}
+	if(unlikely(data->history.frames)) {
+		historyAudio(data, block, sc->audioBlocks, clockTime(&sc->audio, sc->audioBlocks));
+	}
+
+	if(likely(!data->headless)) {
+		queueAudio(data, unlikely(data->timeShift.active) ? timeShiftAudio(data) : block);
+	}
+	sc->audioBlocks++;
+}
+
+// Fill gaps in the sequence with concealment blocks and drop packets that arrive after their slot was filled
+void playAudio(programData *data, const a64msg_t *a)
+{
+	plc_t *p = &data->plc;
+	const int16_t *block = (const int16_t*)((const uint8_t*)a + offsetof(a64msg_t, sample));
+	uint16_t gap = a->seq - (uint16_t)(p->lastSeq + 1);
+
+	if(likely(p->started && gap != 0)) {
+		if((uint16_t)(p->lastSeq - a->seq) < PLC_LATE_WINDOW) {
+			p->late++;
+			return;
+		}
+		// Longer gaps either way are a restarted stream, not loss, play that as it is
+		for(int i=0; i < gap && gap <= PLC_MAX_GAP; i++) {
+			plcSynth(p, p->out);
+			outputAudio(data, p->out);
+			memcpy(p->last, p->out, sizeof(p->last));
+			p->concealed++;
+			p->totalConcealed++;
+		}
+	}
+	p->started = 1;
+	p->lastSeq = a->seq;
+
+	if(unlikely(p->concealed)) {
+		// Crossfade from where the concealment was going into the real thing
+		plcSynth(p, p->out);
+		for(int i=0; i < AUDIO_SAMPLES * AUDIO_CHANNELS; i++) {
+			float w = (i / AUDIO_CHANNELS < PLC_XFADE) ? (float)(i / AUDIO_CHANNELS + 1) / (PLC_XFADE + 1) : 1.0f;
+			p->out[i] = (int16_t)(p->out[i] * (1.0f - w) + block[i] * w);
+		}
+		p->concealed = 0;
+		block = p->out;
+	}
+
+	outputAudio(data, block);
+	memcpy(p->last, block, sizeof(p->last));
+	clockUpdate(&data->clock.audio, clockNow(), data->clock.audioBlocks);
+}
+
+void printAudioStats(programData *data)
+{
+	jitterBuffer_t *jb = &data->jb;
+
+	if(data->headless) {
+		printf("Audio: %"PRIu64" blocks, %"PRIu64" concealed, %"PRIu64" late.\n",
+			data->clock.audioBlocks, data->plc.totalConcealed, data->plc.late);
+	} else {
+		// The integral part is what it settled on to keep up, ie. how far the two clocks are apart
+		printf("Audio: queue %.1f ms (target %i ms, device buffer %i), %i underruns, %"PRIu64" overruns, "
+			"%"PRIu64" concealed, %"PRIu64" late, drift %+.0f ppm.\n",
+			jb->avgFrames * 1000.0 / data->have.freq, data->audioLatency, data->have.samples,
+			SDL_AtomicGet(&data->ring.underruns), jb->overruns, data->plc.totalConcealed, data->plc.late,
+			(((double)U64_AUDIO_FREQUENCY / AUDIO_FREQUENCY) * (1.0 + jb->integral) - 1.0) * 1e6);
+	}
+
+	// Dropped here means the disk fell behind, not the network
+	if(data->rec.thread) {
+		printf("Recorder: backlog %i buffers (high-water %i), %"PRIu64" frames and %"PRIu64" audio blocks dropped.\n",
+			SDL_AtomicGet(&data->rec.backlog), data->rec.highWater, data->rec.droppedFrames, data->rec.droppedBlocks);
+	}
+}
+
+// Everything setupStream() opened, stopped and closed again
+void closeStream(programData *data)
+{
+	if(strlen(data->hostName) && data->stopStreamOnExit && !strlen(data->playName)) {
+		runCommand(data, CMD_STOP_STREAM);
+		if(strlen(data->dbgFile)) {
+			runCommand(data, CMD_STOP_DEBUGSTREAM);
+		}
+	}
+
+	stopDebugCapture(data);
+	stopPacketCapture(data);
+
+	if(data->tex) {
+		SDL_DestroyTexture(data->tex);
+	}
+	if(data->dev) {
+		SDL_CloseAudioDevice(data->dev);
+	}
+
+	// The logic being that if opening either went south, we already exited.
+	stopRecorder(data);
+	stopPipes(data);
+	stopShots(data);
+	stopHistory(data);
+
+	free(data->packed);
+	free(data->clock.frames);
+	rsFree(&data->jb.rs);
+
+	if (data->pkg) {
+		SDLNet_FreePacket(data->pkg);
+	}
+
+	if (data->audpkg) {
+		SDLNet_FreePacket(data->audpkg);
+	}
+
+	if (data->set) {
+		SDLNet_FreeSocketSet(data->set);
+	}
+
+	if (data->udpsock) {
+		SDLNet_UDP_Close(data->udpsock);
+	}
+
+	if (data->audiosock) {
+		SDLNet_UDP_Close(data->audiosock);
+	}
+
+	SDL_DestroyRenderer(data->ren);
+	SDL_DestroyWindow(data->win);
+	SDLNet_Quit();
+	SDL_Quit();
+}
+
+// Without a window there are no keys, signals stand in for the ones that still make sense
+static volatile sig_atomic_t headlessStop = 0;
+static volatile sig_atomic_t headlessRecord = 0;
+static volatile sig_atomic_t headlessDump = 0;
+
+static void headlessSignal(int sig)
+{
+	if(sig == SIGINT || sig == SIGTERM) {
+		headlessStop = 1;
+#ifndef _WIN32
+	} else if(sig == SIGUSR1) {
+		headlessRecord = 1;
+	} else if(sig == SIGUSR2) {
+		headlessDump = 1;
+#endif
+	}
+}
+
+// What would be in the window title, for logs
+void printHeadlessStats(programData *data)
+{
+	printf("Received %"PRIu64" frames (%.1f MiB) and %"PRIu64" audio blocks (%.1f MiB)%s.\n",
+		data->clock.videoUnit, data->totalVdataBytes / (1024.0 * 1024.0),
+		data->clock.audioBlocks, data->totalAdataBytes / (1024.0 * 1024.0),
+		(data->rec.thread && SDL_AtomicGet(&data->rec.active)) ? ", recording" : "");
+}
+
+int setupStream(programData *data)
+{
+	int sdl_init = 0;
+	int sdl_net_init = 0;
+	setColors(data);
+
+	data->pkg = SDLNet_AllocPacket(sizeof(u64msg_t));
+	data->audpkg = SDLNet_AllocPacket(sizeof(a64msg_t));
+
+	data->packed = calloc(1, PACKED_FRAME_SIZE);
+	data->clock.frames = calloc(AV_QUEUE_FRAMES, PACKED_FRAME_SIZE);
+	if(!data->packed || !data->clock.frames) {
+		printf("Error: Could not allocate frame buffers.\n");
+		goto clean_up;
+	}
+	data->clock.audio.period = (double)AUDIO_SAMPLES / U64_AUDIO_FREQUENCY;
+
+	if((strlen(data->recName) || strlen(data->nativeName) || strlen(data->mkvName)) && startRecorder(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+
+	if((strlen(data->pipeVideoName) || strlen(data->pipeAudioName)) && startPipes(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+
+	// Screenshots are of what the window shows
+	if(!data->headless && startShots(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+
+	if(data->history.seconds && startHistory(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	data->clock.video.period = PAL_FRAME_PERIOD;
+
+	// Initialize SDL2
+	sdl_init = SDL_Init(data->headless ? 0 : SDL_INIT_VIDEO|data->audioFlag);
+	if (sdl_init != 0) {
+		printf("SDL_Init Error: %s\n", SDL_GetError());
+		goto clean_up;
+	}
+
+	sdl_net_init = SDLNet_Init();
+	if(sdl_net_init == -1) {
+		printf("SDLNet_Init: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+
+	// Playing a recording only needs the window and the audio device
+	if(strlen(data->playName)) {
+		goto open_output;
+	}
+
+	if(strlen(data->hostName) && data->startStreamOnStart) {
+		if (runCommand(data, CMD_START_STREAM) != EXIT_SUCCESS) {
+			goto clean_up;
+		}
+	}
+
+	if(strlen(data->dbgFile)) {
+		if (startDebugCapture(data) != EXIT_SUCCESS) {
+			goto clean_up;
+		}
+		if(strlen(data->hostName) && data->startStreamOnStart) {
+			if (runCommand(data, CMD_START_DEBUGSTREAM) != EXIT_SUCCESS) {
+				goto clean_up;
+			}
+		}
+	}
+
+	if(strlen(data->pktFile) && strlen(data->replayFile)) {
+		printf("Error: Can't capture packets while replaying them, use either -p or -P.\n");
+		goto clean_up;
+	}
+	if(strlen(data->pktFile) && startPacketCapture(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+	if(strlen(data->replayFile) && startReplay(data) != EXIT_SUCCESS) {
+		goto clean_up;
+	}
+
+	data->set=SDLNet_AllocSocketSet(2);
+	if(!data->set) {
+		printf("SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+
+	printf("Opening UDP socket on port %i for video...\n", data->listen);
+	data->udpsock=SDLNet_UDP_Open(data->listen);
+	if(!data->udpsock) {
+		printf("SDLNet_UDP_Open: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+
+	if( SDLNet_UDP_AddSocket(data->set, data->udpsock) == -1 ) {
+		printf("SDLNet_UDP_AddSocket error: %s\n", SDLNet_GetError());
+		goto clean_up;
+	}
+
+	if(data->audioFlag) {
+		printf("Opening UDP socket on port %i for audio...\n", data->listenaudio);
+		data->audiosock=SDLNet_UDP_Open(data->listenaudio);
+		if(!data->audiosock) {
+			printf("SDLNet_UDP_Open: %s\n", SDLNet_GetError());
+			goto clean_up;
+		}
+
+		if( SDLNet_UDP_AddSocket(data->set, data->audiosock) == -1 ) {
+			printf("SDLNet_UDP_AddSocket error: %s\n", SDLNet_GetError());
+			goto clean_up;
+		}
+	}
+
+	// Headless stops here, audio is still received for recording and pipes but there is no device to play it on
+	if(data->headless) {
+		signal(SIGINT, headlessSignal);
+		signal(SIGTERM, headlessSignal);
+#ifndef _WIN32
+		signal(SIGUSR1, headlessSignal);
+		signal(SIGUSR2, headlessSignal);
+#endif
+		return EXIT_SUCCESS;
+	}
+
+open_output:
+	if(data->audioFlag) {
+		SDL_memset(&data->want, 0, sizeof(data->want));
+		data->want.freq = data->audioFrequency;
+		data->want.format = AUDIO_S16LSB;
+		data->want.channels = AUDIO_CHANNELS;
+		data->want.samples = data->audioSamples;
+		data->want.callback = audioCallback;
+		data->want.userdata = &data->ring;
+		// Take the rate the device runs at, our resampler does a better job than SDLs conversion
+		data->dev = SDL_OpenAudioDevice(NULL, 0, &data->want, &data->have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+		if(data->dev && (data->have.freq < RS_MIN_RATE || data->have.freq > RS_MAX_RATE)) {
+			// Outside what the resampler handles, let SDL convert to the rate we asked for instead
+			SDL_CloseAudioDevice(data->dev);
+			data->dev = SDL_OpenAudioDevice(NULL, 0, &data->want, &data->have, 0);
+		}
+
+		if(data->dev==0) {
+			printf("Failed to open audio: %s", SDL_GetError());
+		}
+
+		data->jb.targetFrames = data->have.freq * data->audioLatency / 1000;
+		if(data->jb.targetFrames < AUDIO_SAMPLES * 2) {
+			data->jb.targetFrames = AUDIO_SAMPLES * 2;
+		} else if(data->jb.targetFrames > AUDIO_RING_FRAMES / 2) {
+			data->jb.targetFrames = AUDIO_RING_FRAMES / 2;
+		}
+		data->jb.avgFrames = data->jb.targetFrames;
+		data->jb.step = (double)U64_AUDIO_FREQUENCY / data->have.freq;
+		if(rsInit(&data->jb.rs, U64_AUDIO_FREQUENCY, data->have.freq) != EXIT_SUCCESS) {
+			printf("Error: Could not allocate resampler.\n");
+			goto clean_up;
+		}
+		if(data->verbose) {
+			printf("Audio device runs at %i Hz, resampling from %i Hz using %s kernel.\n", data->have.freq,
+				U64_AUDIO_FREQUENCY, data->jb.rs.kernelName);
+		}
+
+		SDL_PauseAudioDevice(data->dev, 0);
+	}
+
+	// Create a window
+	data->win = SDL_CreateWindow("Ultimate 64 view!", 100, 100, data->width*data->scale,
+				data->height*data->scale, SDL_WINDOW_SHOWN | data->fullscreenFlag | SDL_WINDOW_RESIZABLE);
+	if (data->win == NULL) {
+		printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
+		goto clean_up;
+	}
+	// Set icon
+	SDL_Surface *iconSurface = SDL_CreateRGBSurfaceFrom(iconPixels,32,32,32,32*4, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+	SDL_SetWindowIcon(data->win, iconSurface);
+	SDL_FreeSurface(iconSurface);
+
+	// Create a renderer
+	data->ren = SDL_CreateRenderer(data->win, -1, (data->vsyncFlag | data->renderFlag));
+	if (data->ren == NULL) {
+		printf("SDL_CreateRenderer Error: %s\n", SDL_GetError());
+		goto clean_up;
+	}
+
+	data->tex = SDL_CreateTexture(data->ren,
+				SDL_PIXELFORMAT_RGBA8888,
+				SDL_TEXTUREACCESS_STREAMING,
+				data->width,
+				data->height);
+
+	if( SDL_LockTexture(data->tex, NULL, (void**)&data->pixels, &data->pitch) ) {
+		printf("Failed to lock texture for writing");
+	}
+
+	return EXIT_SUCCESS;
+
+clean_up:
+	stopDebugCapture(data);
+	stopPacketCapture(data);
+	stopRecorder(data);
+	stopPipes(data);
+	stopShots(data);
+	stopHistory(data);
+	free(data->packed);
+	free(data->clock.frames);
+	rsFree(&data->jb.rs);
+	if (data->pkg) {
+		SDLNet_FreePacket(data->pkg);
+	}
+	if (data->audpkg) {
+		SDLNet_FreePacket(data->audpkg);
+	}
+	if (data->set) {
+		SDLNet_FreeSocketSet(data->set);
+	}
+	if (data->udpsock) {
+		SDLNet_UDP_Close(data->udpsock);
+	}
+	if (data->audiosock) {
+		SDLNet_UDP_Close(data->audiosock);
+	}
+	if (data->tex) {
+		SDL_DestroyTexture(data->tex);
+	}
+	if (data->ren) {
+		SDL_DestroyRenderer(data->ren);
+	}
+	if (data->win) {
+		SDL_DestroyWindow(data->win);
+	}
+	if (sdl_net_init) {
+		SDLNet_Quit();
+	}
+	if (sdl_init) {
+		SDL_Quit();
+	}
+
+	return EXIT_FAILURE;
+}
+
+// Everything that keeps frames gets each one that comes off the queue, shown or not
+static void keepFrame(programData *data, const uint8_t *packed, uint64_t unit)
+{
+	double time = clockTime(&data->clock.video, unit) - data->clock.video.period;
+
+	if(unlikely(data->rec.thread && SDL_AtomicGet(&data->rec.active) && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
+		recordFrame(data, packed, unit, time);
+	}
+	if(unlikely(data->pipeVideo.thread && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
+		pipeFrame(data, packed, unit, time);
+	}
+	if(unlikely(data->history.frames)) {
+		historyFrame(data, packed, unit, time);
+	}
+}
+
+// Expand and show the frames that are due, returns how many were taken off the queue
+static int presentDueFrames(programData *data, double now)
+{
+	streamClock_t *sc = &data->clock;
+	int shown = 0;
+
+	while(sc->queued && sc->due[sc->head] <= now) {
+		sc->shownFrame = sc->frames + sc->head * PACKED_FRAME_SIZE;
+		sc->shownUnit = sc->unit[sc->head];
+		keepFrame(data, sc->shownFrame, sc->shownUnit);
+		sc->head = (sc->head + 1) % AV_QUEUE_FRAMES;
+		sc->queued--;
+		shown++;
+	}
+	// When the loop ran late only the newest is worth expanding, the rest were kept above
+	if(shown && likely(!data->headless)) {
+		expandFrame(data, sc->shownFrame);
+	}
+
+	if(shown && data->dev && sc->audio.started) {
+		double la = audioLatency(data);
+		double lv = now - clockTime(&sc->video, sc->shownUnit);
+		sc->delay += (la - sc->delay) * AV_DELAY_AVERAGE;
+		if(sc->delay < 0) {
+			sc->delay = 0;
+		} else if(sc->delay > AV_MAX_DELAY) {
+			sc->delay = AV_MAX_DELAY;
+		}
+		sc->offset += ((la - lv) - sc->offset) * AV_DELAY_AVERAGE;
+	}
+
+	return shown;
+}
+
+// A frame is complete, queue it to be shown when the audio that goes with it comes out of the speakers
+static void frameDone(programData *data, uint16_t frame, int lines)
+{
+	streamClock_t *sc = &data->clock;
+	double now = clockNow();
+
+	if(unlikely(!sc->video.started)) {
+		// PAL streams have 272 lines, NTSC 240
+		sc->video.period = (lines > NTSC_LINES) ? PAL_FRAME_PERIOD : NTSC_FRAME_PERIOD;
+		sc->lastFrame = frame;
+	}
+	sc->videoUnit += (uint16_t)(frame - sc->lastFrame);
+	sc->lastFrame = frame;
+	clockUpdate(&sc->video, now, sc->videoUnit);
+
+	if(unlikely(sc->queued == AV_QUEUE_FRAMES)) {
+		// More delay than we can hold, show the oldest one now
+		sc->due[sc->head] = 0;
+		int shown = presentDueFrames(data, now);
+		if(unlikely(data->timeShift.active)) {
+			timeShiftAdvance(data, shown);
+		}
+	}
+
+	int slot = (sc->head + sc->queued) % AV_QUEUE_FRAMES;
+	double delay = (data->audioFlag && sc->audio.started) ? sc->delay : 0;
+	memcpy(sc->frames + slot * PACKED_FRAME_SIZE, data->packed, PACKED_FRAME_SIZE);
+	sc->due[slot] = clockTime(&sc->video, sc->videoUnit) + delay;
+	sc->unit[slot] = sc->videoUnit;
+	sc->queued++;
+}
+
+void runStream(programData *data)
+{
+	SDL_Event event;
+	int run = 1;
+	int sync = 1;
+	int staleVideo=7;
+	int r = 0;
+	uint16_t lastAseq=0;
+	uint16_t lastVseq=0;
+	uint32_t lastStats = SDL_GetTicks();
+	uint32_t lastAvStats = SDL_GetTicks();
+	double now = 0;
+
+	if(!data->headless) {
+		pic(data->tex, data->width, data->height, data->pitch, data->pixels);
+	}
+
+	if(strlen(data->loadFile)) {
+		char fileName[MAX_STRING_SIZE];
+		strcpy(fileName, data->loadFile);
+		loadFile(data, fileName);
+	}
+
+	while (run) {
+		if(unlikely(data->headless)) {
+			if(headlessStop) {
+				run = 0;
+			}
+			if(headlessRecord) {
+				headlessRecord = 0;
+				toggleRecording(data);
+			}
+			if(headlessDump) {
+				headlessDump = 0;
+				dumpHistory(data);
+			}
+		}
+
+		while (!data->headless && SDL_PollEvent(&event)) {
+			switch (event.type) {
+			case SDL_KEYDOWN:
+				switch (event.key.keysym.sym) {
+				case SDLK_ESCAPE:
+					run = 0;
+				break;
+				case SDLK_c:
+					data->showHelp=0;
+					data->curColors++;
+					if(data->curColors == NUM_OF_COLORSCHEMES) {
+						data->curColors=SCOLORS;
+					}
+					setColors(data);
+				break;
+				case SDLK_s:
+					data->showHelp=0;
+					if(!strlen(data->hostName)) {
+						printf("Can only start/stop stream when started with -u, -U or -I.\n");
+					} else {
+						if(data->isStreaming) {
+							if (runCommand(data, CMD_STOP_STREAM) != EXIT_SUCCESS) {
+								run = 0;
+							}
+						} else {
+							if (runCommand(data, CMD_START_STREAM) != EXIT_SUCCESS) {
+								run = 0;
+							}
+						}
+					}
+				break;
+				case SDLK_h:
+					data->showHelp=!data->showHelp;
+				break;
+				case SDLK_i:
+					dumpHistory(data);
+				break;
+				case SDLK_o:
+					toggleRecording(data);
+				break;
+				case SDLK_x:
+					shotStart(data, (event.key.keysym.mod & KMOD_SHIFT) ? data->shots.count : 1);
+				break;
+				case SDLK_SPACE:
+				case SDLK_LEFT:
+				case SDLK_RIGHT:
+				case SDLK_PAGEUP:
+				case SDLK_PAGEDOWN:
+				case SDLK_l:
+					if(timeShiftKey(data, event.key.keysym.sym)) {
+						sync=1;
+					}
+				break;
+				case SDLK_p:
+					data->stopStreamOnExit=0;
+					if (powerOff(data) != EXIT_SUCCESS) {
+						run = 0;
+					}
+					memset(data->hostName, 0, sizeof data->hostName);
+				break;
+				case SDLK_r:
+					if(strlen(data->hostName)) {
+						if (runCommand(data, CMD_RESET) != EXIT_SUCCESS) {
+							run = 0;
+						}
+					} else {
+						printf("Can only reset when start with -u, -U or -I.\n");
+					}
+			}
+			break;
+			case SDL_DROPFILE:
+				loadFile(data, event.drop.file);
+				SDL_free(event.drop.file);
+				break;
+			case SDL_QUIT:
+				run=0;
+				break;
+			}
+		}
+
+		// Check for audio
+		if(likely(data->audioFlag)) {
+			r = receivePacket(data, PKT_AUDIO, data->audiosock, data->audpkg);
+			if(likely(r==1)) {
+
+				if(unlikely(data->totalAdataBytes==0)) {
+					printf("Got data on audio port (%i) from %s:%i\n", data->listenaudio,
+						intToIp(data, data->audpkg->address.host), data->audpkg->address.port );
+				}
+				data->totalAdataBytes += sizeof(a64msg_t);
+
+				a64msg_t *a = (a64msg_t*)data->audpkg->data;
+				if(unlikely(data->verbose)) {
+					chkSeq(data, "UDP audio packet missed or out of order, last received: %i current %i\n", &lastAseq, a->seq);
+				}
+
+				playAudio(data, a);
+			} else if(unlikely(r == -1)) {
+				printf("SDLNet_UDP_Recv error: %s\n", SDLNet_GetError());
+			}
+		}
+
+		// Check for video
+		r = receivePacket(data, PKT_VIDEO, data->udpsock, data->pkg);
+		if(likely(r==1 && !data->showHelp)) {
+			if(unlikely(data->totalVdataBytes==0)) {
+				printf("Got data on video port (%i) from %s:%i\n", data->listen,
+				       intToIp(data, data->pkg->address.host), data->pkg->address.port );
+			}
+			data->totalVdataBytes += sizeof(u64msg_t);
+
+			u64msg_t *p = (u64msg_t*)data->pkg->data;
+			if(unlikely(data->verbose)) {
+				chkSeq(data, "UDP video packet missed or out of order, last received: %i current %i\n", &lastVseq, p->seq);
+			}
+
+			int y = p->line & 0b0111111111111111;
+			if(likely(data->fast)) {
+				storeVideoPacket(data, p);
+			} else {
+				for(int l=0; l < p->linexInPacket; l++) {
+					for(int x=0; x < p->pixelsInLine/2; x++) {
+						int idx = x+(l*p->pixelsInLine/2);
+						int pl = (p->payload[idx] & 0x0f);
+						int ph = (p->payload[idx] & 0xf0) >> 4;
+						int r = data->red[pl];
+						int g = data->green[pl];
+						int b = data->blue[pl];
+
+						SDL_SetRenderDrawColor(data->ren, r, g, b, 255);
+						SDL_RenderDrawPoint(data->ren, x*2, y+l);
+						r = data->red[ph];
+						g = data->green[ph];
+						b = data->blue[ph];
+						SDL_SetRenderDrawColor(data->ren, r, g, b, 255);
+						SDL_RenderDrawPoint(data->ren, x*2+1, y+l);
+					}
+				}
+			}
+			if(likely(p->line & 0b1000000000000000)) {
+				if(likely(data->fast)) {
+					frameDone(data, p->frame, y + p->linexInPacket);
+				} else {
+					sync=1;
+				}
+				staleVideo=0;
+			}
+		} else if(unlikely(r == -1)) {
+			printf("SDLNet_UDP_Recv error: %s\n", SDLNet_GetError());
+		} else {
+			staleVideo++;
+			if(unlikely(staleVideo > 5)) {
+				if(staleVideo == 6 && !data->headless) {
+					pic(data->tex, data->width, data->height, data->pitch, data->pixels);
+				} else if(staleVideo%10 == 0) {
+					sync=1;
+				}
+			}
+		}
+
+		now = clockNow();
+		int shown = likely(data->fast) ? presentDueFrames(data, now) : 0;
+		if(shown) {
+			sync=1;
+			if(unlikely(data->timeShift.active)) {
+				timeShiftAdvance(data, shown);
+			}
+		}
+
+		if(likely(sync)) {
+			sync=0;
+			if(likely(data->fast)) {
+				if(unlikely(data->timeShift.active)) {
+					timeShiftShow(data);
+				}
+				if(unlikely(data->shots.pending && data->clock.shownFrame)) {
+					shotLive(data);
+				}
+				if(likely(!data->headless)) {
+					SDL_UnlockTexture(data->tex);
+					SDL_RenderCopy(data->ren, data->tex, NULL, NULL);
+					SDL_RenderPresent(data->ren);
+					if( SDL_LockTexture(data->tex, NULL, (void**)&data->pixels, &data->pitch) ) {
+						printf("Error: Failed to lock texture for writing.");
+					}
+				}
+			} else {
+				SDL_RenderPresent(data->ren);
+			}
+		}
+		if(unlikely(data->verbose && data->audioFlag && SDL_GetTicks() - lastStats > AUDIO_STATS_INTERVAL)) {
+			lastStats = SDL_GetTicks();
+			printAudioStats(data);
+		}
+
+		if(unlikely(data->audioFlag && data->fast && !data->headless && SDL_GetTicks() - lastAvStats > AV_STATS_INTERVAL)) {
+			lastAvStats = SDL_GetTicks();
+			showAvOffset(data);
+		}
+
+		if(unlikely(data->headless && SDL_GetTicks() - lastAvStats > HEADLESS_STATS_INTERVAL)) {
+			lastAvStats = SDL_GetTicks();
+			printHeadlessStats(data);
+		}
+
+		// Wake up in time for the next frame that is due
+		double due = nextFrameDue(data, now);
+		if(unlikely(data->replayMap)) {
+			double next = replayNextDue(data);
+			if(next >= 0 && (due < 0 || next < due)) {
+				due = next;
+			}
+		}
+		SDLNet_CheckSockets(data->set, (due < 0 || due * 1000 > SDLNET_STREAM_TIMEOUT) ? SDLNET_STREAM_TIMEOUT : (int)(due * 1000));
+	}
+
+	if(data->loaderThread) {
+		SDL_WaitThread(data->loaderThread, NULL);
+	}
+
+	closeStream(data);
+}
+
+// Playback of recordings, .u64 or .rgb with .pcm, memory mapped so only what is shown gets read
+static int readSyncOffset(programData *data, const char *name, double *offset)
+{
+	char line[256];
+	FILE *fp;
+
+	if(extName(data, name, ".sync") != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	fp = fopen(data->fnbuf, "r");
+	if(!fp) {
+		return EXIT_FAILURE;
+	}
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "audio_offset=%lf", offset) == 1) {
+			fclose(fp);
+			return EXIT_SUCCESS;
+		}
+	}
+	fclose(fp);
+	return EXIT_FAILURE;
+}
+
+#ifndef _WIN32
+static uint8_t *mapFile(const char *fileName, uint64_t *size)
+{
+	struct stat st;
+	uint8_t *map;
+	int fd = open(fileName, O_RDONLY);
+
+	if(fd == -1) {
+		return NULL;
+	}
+	if(fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return NULL;
+	}
+	*size = st.st_size;
+	return map;
+}
+
+// Where every frame and audio block is, so seeking never has to read the recording itself
+static int buildPlayIndex(programData *data, player_t *pl)
+{
+	uint64_t pos = sizeof(nativeHeader_t);
+	uint64_t palette = 0;
+	uint64_t key = 0;
+	uint64_t maxFrames = 0, maxBlocks = 0;
+
+	pl->frames = 0;
+	pl->blocks = 0;
+	while(pos + sizeof(nativeChunk_t) <= pl->mapSize) {
+		nativeChunk_t c;
+		memcpy(&c, pl->map + pos, sizeof(c));
+		if(pos + sizeof(c) + c.size > pl->mapSize) {
+			printf("Warning: %s is truncated, playing what is there.\n", data->fnbuf);
+			break;
+		}
+
+		if(c.type == NATIVE_PALETTE) {
+			palette = pos;
+		} else if(c.type == NATIVE_VIDEO || c.type == NATIVE_VIDEO_KEY || c.type == NATIVE_VIDEO_DELTA || c.type == NATIVE_VIDEO_REPEAT) {
+			if(c.type == NATIVE_VIDEO || c.type == NATIVE_VIDEO_KEY) {
+				key = pl->frames;
+			}
+			if(pl->frames == maxFrames) {
+				maxFrames = maxFrames ? maxFrames * 2 : 4096;
+				playFrame_t *f = realloc(pl->frameIdx, maxFrames * sizeof(playFrame_t));
+				if(!f) {
+					return EXIT_FAILURE;
+				}
+				pl->frameIdx = f;
+			}
+			pl->frameIdx[pl->frames++] = (playFrame_t){ pos, palette, key, c.time };
+		} else if(c.type == NATIVE_AUDIO && c.size == SAMPLE_SIZE) {
+			if(pl->blocks == maxBlocks) {
+				maxBlocks = maxBlocks ? maxBlocks * 2 : 16384;
+				playBlock_t *b = realloc(pl->blockIdx, maxBlocks * sizeof(playBlock_t));
+				if(!b) {
+					return EXIT_FAILURE;
+				}
+				pl->blockIdx = b;
+			}
+			pl->blockIdx[pl->blocks++] = (playBlock_t){ pos + sizeof(c), c.time };
+		}
+		pos += sizeof(c) + c.size;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// A chunk of the type asked for that lies entirely within the recording
+static int playChunkValid(player_t *pl, uint64_t pos, int video)
+{
+	nativeChunk_t c;
+
+	if(pos < sizeof(nativeHeader_t) || pos > pl->mapSize || pl->mapSize - pos < sizeof(c)) {
+		return 0;
+	}
+	memcpy(&c, pl->map + pos, sizeof(c));
+	if(c.size > pl->mapSize - pos - sizeof(c)) {
+		return 0;
+	}
+	if(video) {
+		return c.type == NATIVE_VIDEO || c.type == NATIVE_VIDEO_KEY || c.type == NATIVE_VIDEO_DELTA || c.type == NATIVE_VIDEO_REPEAT;
+	}
+	return c.type == NATIVE_PALETTE && c.size >= NATIVE_PALETTE_SIZE * sizeof(uint32_t);
+}
+
+// The index file could be stale, damaged or edited, playback trusts every offset in it
+static int playIndexValid(player_t *pl)
+{
+	for(uint64_t i=0; i < pl->frames; i++) {
+		const playFrame_t *f = &pl->frameIdx[i];
+		if(f->key > i || !playChunkValid(pl, f->offset, 1) || (f->palette && !playChunkValid(pl, f->palette, 0))) {
+			return 0;
+		}
+	}
+	for(uint64_t i=0; i < pl->blocks; i++) {
+		uint64_t offset = pl->blockIdx[i].offset;
+		if(offset < sizeof(nativeHeader_t) + sizeof(nativeChunk_t) || offset > pl->mapSize || pl->mapSize - offset < SAMPLE_SIZE) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// The index is kept next to the recording, a multi hour recording is only scanned once
+static int loadPlayIndex(programData *data, player_t *pl, const char *name)
+{
+	playIndexHeader_t h;
+	FILE *fp;
+	int result = EXIT_FAILURE;
+
+	if(extName(data, name, ".u64.idx") != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	fp = fopen(data->fnbuf, "rb");
+	if(!fp) {
+		return EXIT_FAILURE;
+	}
+	// Every frame and block has at least a chunk header in the recording, more than that can't be right
+	if(fread(&h, sizeof(h), 1, fp) == 1 && !memcmp(h.magic, PLAY_INDEX_MAGIC, sizeof(h.magic)) &&
+	   h.version == PLAY_INDEX_VERSION && h.sourceSize == pl->mapSize &&
+	   h.frames <= pl->mapSize / sizeof(nativeChunk_t) && h.blocks <= pl->mapSize / sizeof(nativeChunk_t)) {
+		pl->frameIdx = malloc(h.frames * sizeof(playFrame_t) + 1);
+		pl->blockIdx = malloc(h.blocks * sizeof(playBlock_t) + 1);
+		pl->frames = h.frames;
+		pl->blocks = h.blocks;
+		if(pl->frameIdx && pl->blockIdx &&
+		   fread(pl->frameIdx, sizeof(playFrame_t), h.frames, fp) == h.frames &&
+		   fread(pl->blockIdx, sizeof(playBlock_t), h.blocks, fp) == h.blocks && playIndexValid(pl)) {
+			result = EXIT_SUCCESS;
+		} else {
+			if(pl->frameIdx && pl->blockIdx) {
+				printf("%s doesn't match the recording, indexing it again.\n", data->fnbuf);
+			}
+			pl->frames = 0;
+			pl->blocks = 0;
+			free(pl->frameIdx);
+			free(pl->blockIdx);
+			pl->frameIdx = NULL;
+			pl->blockIdx = NULL;
+		}
+	}
+	fclose(fp);
+
+	return result;
+}
+
+static void savePlayIndex(programData *data, player_t *pl, const char *name)
+{
+	playIndexHeader_t h;
+	FILE *fp;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PLAY_INDEX_MAGIC, sizeof(h.magic));
+	h.version = PLAY_INDEX_VERSION;
+	h.sourceSize = pl->mapSize;
+	h.frames = pl->frames;
+	h.blocks = pl->blocks;
+
+	if(extName(data, name, ".u64.idx") != EXIT_SUCCESS) {
+		return;
+	}
+	fp = fopen(data->fnbuf, "wb");
+	if(!fp) {
+		return;
+	}
+	if(fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	   fwrite(pl->frameIdx, sizeof(playFrame_t), pl->frames, fp) != pl->frames ||
+	   fwrite(pl->blockIdx, sizeof(playBlock_t), pl->blocks, fp) != pl->blocks) {
+		printf("Error writing %s.\n", data->fnbuf);
+	}
+	fclose(fp);
+}
+#endif
+
+void closePlayback(player_t *pl)
+{
+#ifndef _WIN32
+	if(pl->map) {
+		munmap(pl->map, pl->mapSize);
+	}
+	if(pl->pcm) {
+		munmap(pl->pcm, pl->pcmSize);
+	}
+#endif
+	free(pl->frameIdx);
+	free(pl->blockIdx);
+	free(pl->packed);
+	pl->map = NULL;
+	pl->pcm = NULL;
+	pl->frameIdx = NULL;
+	pl->blockIdx = NULL;
+	pl->packed = NULL;
+}
+
+int openPlayback(programData *data)
+{
+#ifdef _WIN32
+	printf("Playback is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	player_t *pl = &data->play;
+	const char *name = data->playName;
+
+	pl->speed = 1;
+	pl->decoded = UINT64_MAX;
+	pl->blockPeriod = (double)AUDIO_SAMPLES / U64_AUDIO_FREQUENCY;
+
+	if(extName(data, name, ".u64") != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	pl->map = mapFile(data->fnbuf, &pl->mapSize);
+	if(pl->map) {
+		nativeHeader_t h;
+		if(pl->mapSize < sizeof(h)) {
+			goto bad;
+		}
+		memcpy(&h, pl->map, sizeof(h));
+		if(memcmp(h.magic, NATIVE_MAGIC, sizeof(h.magic)) || h.version > NATIVE_VERSION ||
+		   h.width != data->width || h.height != data->height || h.audioBlockSize != SAMPLE_SIZE) {
+			goto bad;
+		}
+		pl->native = 1;
+		pl->framePeriod = h.framePeriod;
+		pl->packed = malloc(PACKED_FRAME_SIZE);
+		if(!pl->packed) {
+			goto bad;
+		}
+
+		if(loadPlayIndex(data, pl, name) != EXIT_SUCCESS) {
+			printf("Indexing %s.u64...\n", name);
+			if(buildPlayIndex(data, pl) != EXIT_SUCCESS) {
+				printf("Error: Out of memory indexing %s.u64.\n", name);
+				closePlayback(pl);
+				return EXIT_FAILURE;
+			}
+			savePlayIndex(data, pl, name);
+		}
+		if(!pl->frames) {
+			goto bad;
+		}
+		pl->start = pl->frameIdx[0].time;
+		pl->duration = pl->frameIdx[pl->frames - 1].time - pl->start + pl->framePeriod;
+	} else {
+		if(extName(data, name, ".rgb") != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		pl->map = mapFile(data->fnbuf, &pl->mapSize);
+		if(!pl->map) {
+			printf("Error: Found neither %s.u64 nor %s.rgb to play.\n", name, name);
+			return EXIT_FAILURE;
+		}
+		pl->frameSize = sizeof(uint32_t) * data->width * data->height;
+		pl->frames = pl->mapSize / pl->frameSize;
+		if(!pl->frames) {
+			goto bad;
+		}
+		// Older recordings have no .sync, the frame rate was PAL and audio started with video
+		pl->framePeriod = PAL_FRAME_PERIOD;
+		if(readSyncOffset(data, name, &pl->audioOffset) != EXIT_SUCCESS) {
+			pl->audioOffset = 0;
+		}
+		if(extName(data, name, ".pcm") != EXIT_SUCCESS) {
+			closePlayback(pl);
+			return EXIT_FAILURE;
+		}
+		pl->pcm = mapFile(data->fnbuf, &pl->pcmSize);
+		pl->blocks = pl->pcm ? pl->pcmSize / SAMPLE_SIZE : 0;
+		pl->duration = pl->frames * pl->framePeriod;
+	}
+
+	madvise(pl->map, pl->mapSize, MADV_SEQUENTIAL);
+	if(pl->pcm) {
+		madvise(pl->pcm, pl->pcmSize, MADV_SEQUENTIAL);
+	}
+
+	printf("Playing %s: %"PRIu64" frames, %"PRIu64" audio blocks, %.1f seconds.\n", name, pl->frames, pl->blocks, pl->duration);
+	printf("Space pauses, left/right step a frame, page up/down jump 5 s, 0-9 jump to 0-90%%, +/- change speed, o toggles looping.\n");
+	return EXIT_SUCCESS;
+
+bad:
+	printf("Error: %s is not a recording this version can play.\n", data->fnbuf);
+	closePlayback(pl);
+	return EXIT_FAILURE;
+#endif
+}
+
+// Start of the frame, seconds from the start of the recording
+static inline double playFrameTime(player_t *pl, uint64_t i)
+{
+	return pl->native ? pl->frameIdx[i].time - pl->start : i * pl->framePeriod;
+}
+
+static inline double playBlockTime(player_t *pl, uint64_t i)
+{
+	return pl->native ? pl->blockIdx[i].time - pl->start : pl->audioOffset + i * pl->blockPeriod;
+}
+
+// Guess from the rate, then walk the few entries dropped or repeated frames moved it by
+static uint64_t playFrameAt(player_t *pl, double t)
+{
+	int64_t i = t / pl->framePeriod;
+
+	if(i < 0) {
+		return 0;
+	}
+	if((uint64_t)i >= pl->frames) {
+		i = pl->frames - 1;
+	}
+	while(i > 0 && playFrameTime(pl, i) > t) {
+		i--;
+	}
+	while((uint64_t)i + 1 < pl->frames && playFrameTime(pl, i + 1) <= t) {
+		i++;
+	}
+	return i;
+}
+
+static uint64_t playBlockAt(player_t *pl, double t)
+{
+	if(!pl->blocks) {
+		return 0;
+	}
+	int64_t i = (t - playBlockTime(pl, 0)) / pl->blockPeriod;
+
+	if(i < 0) {
+		return 0;
+	}
+	if((uint64_t)i >= pl->blocks) {
+		return pl->blocks;
+	}
+	while(i > 0 && playBlockTime(pl, i - 1) >= t) {
+		i--;
+	}
+	while((uint64_t)i < pl->blocks && playBlockTime(pl, i) < t) {
+		i++;
+	}
+	return i;
+}
+
+// Decode from the nearest keyframe, or carry on from the frame already decoded if that is closer
+static int playDecode(player_t *pl, uint64_t i)
+{
+	uint64_t from = pl->frameIdx[i].key;
+
+	if(pl->decoded != UINT64_MAX && pl->decoded <= i && pl->decoded >= from) {
+		from = pl->decoded + 1;
+	}
+	for(uint64_t f = from; f <= i; f++) {
+		nativeChunk_t c;
+		memcpy(&c, pl->map + pl->frameIdx[f].offset, sizeof(c));
+		if(decodeNativeFrame(c.type, pl->map + pl->frameIdx[f].offset + sizeof(c), c.size, pl->packed) != EXIT_SUCCESS) {
+			pl->decoded = UINT64_MAX;
+			return EXIT_FAILURE;
+		}
+		pl->decoded = f;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Ask for the next second or so to be read in, whenever playback gets halfway through what was asked for last
+static void playReadAhead(player_t *pl, uint64_t i)
+{
+#ifndef _WIN32
+	if(i >= pl->aheadFrom && i + PLAY_READAHEAD_FRAMES / 2 < pl->aheadUntil) {
+		return;
+	}
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t from = (i * pl->frameSize) & ~(page - 1);
+	uint64_t to = (i + PLAY_READAHEAD_FRAMES) * pl->frameSize;
+	if(to > pl->mapSize) {
+		to = pl->mapSize;
+	}
+	madvise(pl->map + from, to - from, MADV_WILLNEED);
+	pl->aheadFrom = i;
+	pl->aheadUntil = i + PLAY_READAHEAD_FRAMES;
+#endif
+}
+
+// .rgb frames are already in the texture format, they go from the page cache to the texture without a copy of our own
+static void playShow(programData *data, uint64_t i)
+{
+	player_t *pl = &data->play;
+
+	if(pl->native) {
+		uint32_t palette[NATIVE_PALETTE_SIZE];
+		uint64_t pixMap[PIXMAP_SIZE];
+		if(playDecode(pl, i) != EXIT_SUCCESS || !pl->frameIdx[i].palette) {
+			printf("Error: Frame %"PRIu64" of the recording is damaged.\n", i);
+			return;
+		}
+		memcpy(palette, pl->map + pl->frameIdx[i].palette + sizeof(nativeChunk_t), sizeof(palette));
+		if(unlikely(data->shots.pending)) {
+			shotSubmit(data, pl->packed, palette);
+		}
+		paletteToPixMap(palette, pixMap);
+		expandPacked(pl->packed, pixMap, data->pixels, data->width, data->height, data->pitch / 8);
+		SDL_UnlockTexture(data->tex);
+	} else {
+		playReadAhead(pl, i);
+		if(SDL_UpdateTexture(data->tex, NULL, pl->map + i * pl->frameSize, data->width * sizeof(uint32_t))) {
+			printf("Error: Failed to update texture: %s\n", SDL_GetError());
+		}
+	}
+
+	SDL_RenderCopy(data->ren, data->tex, NULL, NULL);
+	SDL_RenderPresent(data->ren);
+
+	if(pl->native && SDL_LockTexture(data->tex, NULL, (void**)&data->pixels, &data->pitch)) {
+		printf("Error: Failed to lock texture for writing.");
+	}
+}
+
+static void playSeek(programData *data, double t)
+{
+	player_t *pl = &data->play;
+	double lead = (data->jb.targetFrames + data->have.samples) / (double)(data->have.freq ? data->have.freq : 1);
+
+	if(t < 0) {
+		t = 0;
+	} else if(t > pl->duration) {
+		t = pl->duration;
+	}
+	pl->pos = t;
+	pl->wallStart = clockNow();
+	pl->posStart = t;
+	// Audio is queued ahead by the buffer latency, so the block heard is the one that goes with the frame shown
+	pl->nextBlock = playBlockAt(pl, t + lead);
+}
+
+static void showPlayTitle(programData *data)
+{
+	player_t *pl = &data->play;
+	char title[MAX_STRING_SIZE];
+
+	snprintf(title, sizeof(title), "Ultimate 64 view! (%i:%05.2f / %i:%05.2f, %gx%s%s)", (int)(pl->pos / 60), fmod(pl->pos, 60),
+		(int)(pl->duration / 60), fmod(pl->duration, 60), pl->speed, pl->paused ? ", paused" : "", pl->loop ? ", looping" : "");
+	SDL_SetWindowTitle(data->win, title);
+}
+
+void runPlayback(programData *data)
+{
+	player_t *pl = &data->play;
+	SDL_Event event;
+	int run = 1;
+	uint64_t shown = UINT64_MAX;
+	uint32_t lastTitle = 0;
+
+	// .rgb frames are handed to SDL_UpdateTexture, which wants the texture unlocked
+	if(!pl->native) {
+		SDL_UnlockTexture(data->tex);
+	}
+	playSeek(data, 0);
+
+	while(run) {
+		int redraw = 0;
+		while(SDL_PollEvent(&event)) {
+			if(event.type == SDL_QUIT) {
+				run = 0;
+			} else if(event.type == SDL_KEYDOWN) {
+				SDL_Keycode key = event.key.keysym.sym;
+				uint64_t cur = playFrameAt(pl, pl->pos);
+				switch(key) {
+					case SDLK_ESCAPE:
 						run = 0;
-					}
-					memset(data->hostName, 0, sizeof data->hostName);
-				break;
-				case SDLK_r:
-					if(strlen(data->hostName)) {
-						if (runCommand(data, CMD_RESET) != EXIT_SUCCESS) {
-							run = 0;
+						break;
+					case SDLK_SPACE:
+						pl->paused = !pl->paused;
+						playSeek(data, pl->pos);
+						break;
+					case SDLK_LEFT:
+						pl->paused = 1;
+						playSeek(data, cur ? playFrameTime(pl, cur - 1) : 0);
+						break;
+					case SDLK_RIGHT:
+						pl->paused = 1;
+						playSeek(data, cur + 1 < pl->frames ? playFrameTime(pl, cur + 1) : pl->pos);
+						break;
+					case SDLK_PAGEUP:
+						playSeek(data, pl->pos - TIMESHIFT_JUMP);
+						break;
+					case SDLK_PAGEDOWN:
+						playSeek(data, pl->pos + TIMESHIFT_JUMP);
+						break;
+					case SDLK_PLUS:
+					case SDLK_KP_PLUS:
+					case SDLK_EQUALS:
+						if(pl->speed < PLAY_MAX_SPEED) {
+							pl->speed *= 2;
 						}
-					} else {
-						printf("Can only reset when start with -u, -U or -I.\n");
-					}
+						playSeek(data, pl->pos);
+						break;
+					case SDLK_MINUS:
+					case SDLK_KP_MINUS:
+						if(pl->speed > 1.0 / PLAY_MAX_SPEED) {
+							pl->speed /= 2;
+						}
+						playSeek(data, pl->pos);
+						break;
+					case SDLK_o:
+						pl->loop = !pl->loop;
+						break;
+					case SDLK_x:
+						shotStart(data, (event.key.keysym.mod & KMOD_SHIFT) ? data->shots.count : 1);
+						break;
+					default:
+						if(key >= SDLK_0 && key <= SDLK_9) {
+							playSeek(data, pl->duration * (key - SDLK_0) / 10);
+						}
+						break;
+				}
+				redraw = 1;
+				lastTitle = 0;
 			}
-			break;
-			case SDL_QUIT:
-				run=0;
-				break;
+		}
+
+		double now = clockNow();
+		if(!pl->paused) {
+			pl->pos = pl->posStart + (now - pl->wallStart) * pl->speed;
+			if(pl->pos >= pl->duration) {
+				if(pl->loop) {
+					playSeek(data, 0);
+				} else {
+					pl->pos = pl->duration;
+					pl->paused = 1;
+				}
 			}
 		}
 
-		// Check for audio
-		if(likely(data->audioFlag)) {
-			r = SDLNet_UDP_Recv(data->audiosock, data->audpkg);
-			if(likely(r==1)) {
+		// Only at normal speed, the jitter buffer smooths out the wall clock against the sound card clock
+		if(data->audioFlag && data->have.freq && !pl->paused && pl->speed == 1) {
+			double lead = (data->jb.targetFrames + data->have.samples) / (double)data->have.freq;
+			while(pl->nextBlock < pl->blocks && playBlockTime(pl, pl->nextBlock) <= pl->pos + lead) {
+				const void *block = pl->native ? pl->map + pl->blockIdx[pl->nextBlock].offset : pl->pcm + pl->nextBlock * SAMPLE_SIZE;
+				queueAudio(data, block);
+				pl->nextBlock++;
+			}
+		}
 
-				if(unlikely(data->totalAdataBytes==0)) {
-					printf("Got data on audio port (%i) from %s:%i\n", data->listenaudio,
-						intToIp(data, data->audpkg->address.host), data->audpkg->address.port );
-				}
-				data->totalAdataBytes += sizeof(a64msg_t);
+		uint64_t i = playFrameAt(pl, pl->pos);
+		if(i != shown || redraw) {
+			playShow(data, i);
+			shown = i;
+		}
 
-				a64msg_t *a = (a64msg_t*)data->audpkg->data;
-				if(unlikely(data->verbose)) {
-					chkSeq(data, "UDP audio packet missed or out of order, last received: %i current %i\n", &lastAseq, a->seq);
-				}
+		if(SDL_GetTicks() - lastTitle > AV_STATS_INTERVAL / 4) {
+			lastTitle = SDL_GetTicks();
+			showPlayTitle(data);
+		}
 
-				if(unlikely(data->afp && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
-					fwrite(a->sample, SAMPLE_SIZE, 1, data->afp);
-				}
+		// Sleep until the next frame is due, or a bit while paused
+		double wait = PLAY_IDLE_WAIT;
+		if(!pl->paused && i + 1 < pl->frames) {
+			wait = (playFrameTime(pl, i + 1) - pl->pos) / pl->speed;
+		}
+		if(wait > PLAY_IDLE_WAIT) {
+			wait = PLAY_IDLE_WAIT;
+		}
+		if(wait > 0.001) {
+			SDL_Delay(wait * 1000);
+		}
+	}
 
-				SDL_QueueAudio(data->dev, a->sample, SAMPLE_SIZE );
-			} else if(unlikely(r == -1)) {
-				printf("SDLNet_UDP_Recv error: %s\n", SDLNet_GetError());
+	closePlayback(pl);
+	closeStream(data);
+}
+
+#ifndef _WIN32
+static inline uint32_t transcodeHash(uint32_t color)
+{
+	return (color * 0x9e3779b1u) >> (32 - TRANSCODE_LOOKUP_BITS);
+}
+
+// The palettes -o may have written with, and a table from color back to index for each
+static void transcodeBuildPalettes(programData *data, transcoder_t *tc)
+{
+	colorScheme cur = data->curColors;
+
+	for(int s=0; s < NUM_OF_COLORSCHEMES; s++) {
+		data->curColors = s;
+		setColors(data);
+		pixMapPalette(data->pixMap, tc->palette[s]);
+		for(int i=0; i < NATIVE_PALETTE_SIZE; i++) {
+			uint32_t c = tc->palette[s][i];
+			uint32_t h = transcodeHash(c);
+			while(tc->lookupColor[s][h] && tc->lookupColor[s][h] != c) {
+				h = (h + 1) & (TRANSCODE_LOOKUP_SIZE - 1);
+			}
+			// A palette may have the same color twice, either index expands to the same pixels
+			if(!tc->lookupColor[s][h]) {
+				tc->lookupColor[s][h] = c;
+				tc->lookupIndex[s][h] = i;
 			}
 		}
+	}
+	data->curColors = cur;
+	setColors(data);
+}
 
-		// Check for video
-		r = SDLNet_UDP_Recv(data->udpsock, data->pkg);
-		if(likely(r==1 && !data->showHelp)) {
-			if(unlikely(data->totalVdataBytes==0)) {
-				printf("Got data on video port (%i) from %s:%i\n", data->listen,
-				       intToIp(data, data->pkg->address.host), data->pkg->address.port );
-			}
-			data->totalVdataBytes += sizeof(u64msg_t);
+// Fails on the first pixel that isn't in the palette
+static int transcodeQuantize(const transcoder_t *tc, int scheme, const uint32_t *argb, uint8_t *packed)
+{
+	const uint32_t *colors = tc->lookupColor[scheme];
+	const uint8_t *index = tc->lookupIndex[scheme];
+	uint32_t last = 0;
+	uint8_t lastIndex = 0;
+	int haveLast = 0;
 
-			u64msg_t *p = (u64msg_t*)data->pkg->data;
-			if(unlikely(data->verbose)) {
-				chkSeq(data, "UDP video packet missed or out of order, last received: %i current %i\n", &lastVseq, p->seq);
+	for(int i=0; i < PACKED_FRAME_SIZE * 2; i++) {
+		uint32_t c = argb[i];
+		if(c != last || !haveLast) {
+			// 0 marks a free slot, no color of a palette is ever that
+			if(unlikely(!c)) {
+				return EXIT_FAILURE;
+			}
+			uint32_t h = transcodeHash(c);
+			while(colors[h] != c) {
+				if(!colors[h]) {
+					return EXIT_FAILURE;
+				}
+				h = (h + 1) & (TRANSCODE_LOOKUP_SIZE - 1);
 			}
+			last = c;
+			lastIndex = index[h];
+			haveLast = 1;
+		}
+		if(i & 1) {
+			packed[i >> 1] |= lastIndex << 4;
+		} else {
+			packed[i >> 1] = lastIndex;
+		}
+	}
+	return EXIT_SUCCESS;
+}
 
-			int y = p->line & 0b0111111111111111;
-			if(likely(data->fast)) {
-				int lpp = p->linexInPacket;
-				int hppl =p->pixelsInLine/2;
-				for(int l=0; l < lpp; l++) {
-					for(int x=0; x < hppl; x++) {
-						int idx = x+(l*hppl);
-						uint8_t pc = (p->payload[idx]);
-						((uint64_t*)data->pixels)[x + ((y+l)*data->pitch/8)] = data->pixMap[pc];
+// Takes the next keyframe interval, quantizes and codes it into its slot, the main thread writes the slots out in order
+static int transcodeWorker(void *ptr)
+{
+	transcodeWork_t *w = (transcodeWork_t*)ptr;
+	transcoder_t *tc = w->tc;
+	frameCodec_t codec;
+	uint8_t *packed = malloc(PACKED_FRAME_SIZE);
+	int scheme = SCOLORS;
+
+	if(!packed || codecInit(&codec) != EXIT_SUCCESS) {
+		free(packed);
+		SDL_LockMutex(tc->lock);
+		tc->failed = 1;
+		SDL_CondBroadcast(tc->cond);
+		SDL_UnlockMutex(tc->lock);
+		return 0;
+	}
+
+	for(;;) {
+		SDL_LockMutex(tc->lock);
+		// Stay within the slots, so memory use doesn't grow with the recording when the disk is the slow part
+		while(!tc->failed && tc->next < tc->chunks && tc->next >= tc->written + tc->window) {
+			SDL_CondWait(tc->cond, tc->lock);
+		}
+		if(tc->failed || tc->next >= tc->chunks) {
+			SDL_UnlockMutex(tc->lock);
+			break;
+		}
+		uint64_t k = tc->next++;
+		SDL_UnlockMutex(tc->lock);
+
+		uint64_t start = SDL_GetPerformanceCounter();
+		transcodeSlot_t *s = &tc->slots[k % tc->window];
+		uint64_t first = k * NATIVE_KEYFRAME_INTERVAL;
+		uint32_t n = (tc->frames - first < NATIVE_KEYFRAME_INTERVAL) ? tc->frames - first : NATIVE_KEYFRAME_INTERVAL;
+		uint64_t bad = UINT64_MAX;
+		size_t pos = 0;
+		for(uint32_t i=0; i < n; i++) {
+			const uint32_t *argb = (const uint32_t*)(tc->map + (first + i) * tc->frameSize);
+			// The palette seldom changes, so the one of the frame before is tried first
+			if(transcodeQuantize(tc, scheme, argb, packed) != EXIT_SUCCESS) {
+				int found = -1;
+				for(int p=0; p < NUM_OF_COLORSCHEMES && found < 0; p++) {
+					if(p != scheme && transcodeQuantize(tc, p, argb, packed) == EXIT_SUCCESS) {
+						found = p;
 					}
 				}
+				if(found < 0) {
+					bad = first + i;
+					break;
+				}
+				scheme = found;
+			}
+			size_t size = 0;
+			if(i && !memcmp(packed, codec.prev, PACKED_FRAME_SIZE)) {
+				s->type[i] = NATIVE_VIDEO_REPEAT;
+			} else if((size = codecEncode(&codec, packed, i == 0, s->coded + pos))) {
+				s->type[i] = i ? NATIVE_VIDEO_DELTA : NATIVE_VIDEO_KEY;
 			} else {
-				for(int l=0; l < p->linexInPacket; l++) {
-					for(int x=0; x < p->pixelsInLine/2; x++) {
-						int idx = x+(l*p->pixelsInLine/2);
-						int pl = (p->payload[idx] & 0x0f);
-						int ph = (p->payload[idx] & 0xf0) >> 4;
-						int r = data->red[pl];
-						int g = data->green[pl];
-						int b = data->blue[pl];
+				memcpy(s->coded + pos, packed, PACKED_FRAME_SIZE);
+				size = PACKED_FRAME_SIZE;
+				s->type[i] = NATIVE_VIDEO;
+			}
+			s->size[i] = size;
+			s->scheme[i] = scheme;
+			pos += size;
+		}
+		w->frames += n;
+		w->busy += (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
 
-						SDL_SetRenderDrawColor(data->ren, r, g, b, 255);
-						SDL_RenderDrawPoint(data->ren, x*2, y+l);
-						r = data->red[ph];
-						g = data->green[ph];
-						b = data->blue[ph];
-						SDL_SetRenderDrawColor(data->ren, r, g, b, 255);
-						SDL_RenderDrawPoint(data->ren, x*2+1, y+l);
-					}
-				}
+		SDL_LockMutex(tc->lock);
+		if(bad != UINT64_MAX) {
+			tc->failed = 1;
+			if(bad < tc->badFrame) {
+				tc->badFrame = bad;
 			}
-			if(likely(p->line & 0b1000000000000000)) {
-				sync=1;
-				staleVideo=0;
+		}
+		s->frames = n;
+		s->chunk = k;
+		SDL_CondBroadcast(tc->cond);
+		SDL_UnlockMutex(tc->lock);
+	}
+
+	codecFree(&codec);
+	free(packed);
+	return 0;
+}
+
+// Decodes its keyframe intervals from the written file and compares them to the .rgb they came from
+static int transcodeVerifyWorker(void *ptr)
+{
+	transcodeWork_t *w = (transcodeWork_t*)ptr;
+	transcoder_t *tc = w->tc;
+	uint8_t *packed = malloc(PACKED_FRAME_SIZE);
+	uint32_t *argb = malloc(tc->frameSize);
+	uint64_t pixMap[PIXMAP_SIZE];
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	if(!packed || !argb) {
+		free(packed);
+		free(argb);
+		SDL_AtomicAdd(&tc->mismatches, 1);
+		return 0;
+	}
+
+	for(uint64_t k = w->first; k < w->last; k++) {
+		uint64_t pos = tc->chunkOffset[k];
+		uint64_t f = k * NATIVE_KEYFRAME_INTERVAL;
+		uint64_t end = (tc->frames - f < NATIVE_KEYFRAME_INTERVAL) ? tc->frames : f + NATIVE_KEYFRAME_INTERVAL;
+
+		paletteToPixMap(tc->palette[tc->chunkScheme[k]], pixMap);
+		while(f < end) {
+			nativeChunk_t c;
+			if(pos + sizeof(c) > tc->outSize) {
+				break;
 			}
-		} else if(unlikely(r == -1)) {
-			printf("SDLNet_UDP_Recv error: %s\n", SDLNet_GetError());
-		} else {
-			staleVideo++;
-			if(unlikely(staleVideo > 5)) {
-				if(staleVideo == 6) {
-					pic(data->tex, data->width, data->height, data->pitch, data->pixels);
-				} else if(staleVideo%10 == 0) {
-					sync=1;
+			memcpy(&c, tc->out + pos, sizeof(c));
+			pos += sizeof(c);
+			if(c.size > tc->outSize - pos) {
+				break;
+			}
+			const uint8_t *payload = tc->out + pos;
+			pos += c.size;
+
+			if(c.type == NATIVE_PALETTE && c.size == NATIVE_PALETTE_SIZE * sizeof(uint32_t)) {
+				uint32_t palette[NATIVE_PALETTE_SIZE];
+				memcpy(palette, payload, sizeof(palette));
+				paletteToPixMap(palette, pixMap);
+			} else if(c.type == NATIVE_VIDEO || c.type == NATIVE_VIDEO_KEY || c.type == NATIVE_VIDEO_DELTA || c.type == NATIVE_VIDEO_REPEAT) {
+				if(c.seq != f || decodeNativeFrame(c.type, payload, c.size, packed) != EXIT_SUCCESS) {
+					break;
 				}
+				expandPacked(packed, pixMap, argb, tc->width, tc->height, tc->width / 2);
+				if(memcmp(argb, tc->map + f * tc->frameSize, tc->frameSize)) {
+					break;
+				}
+				f++;
+				w->frames++;
 			}
 		}
+		if(f < end) {
+			SDL_AtomicAdd(&tc->mismatches, end - f);
+		}
+	}
+	w->busy = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
 
-		if(likely(sync)) {
-			sync=0;
-			if(likely(data->fast)) {
-				if(unlikely(data->vfp && data->totalVdataBytes != 0 && data->totalAdataBytes != 0)) {
-					fwrite(data->pixels, sizeof(uint32_t)*data->width*data->height, 1, data->vfp);
+	free(packed);
+	free(argb);
+	return 0;
+}
+#endif
+
+// Turns a -o recording into a .u64 on every core, coding each keyframe interval on its own, then reads it back to prove nothing was lost
+int transcodeRecording(programData *data)
+{
+#ifdef _WIN32
+	printf("Transcoding is not supported on this platform.\n");
+	return EXIT_FAILURE;
+#else
+	const char *name = data->transcodeName;
+	transcoder_t tc;
+	transcodeWork_t work[DBG_MAX_THREADS];
+	SDL_Thread *thr[DBG_MAX_THREADS];
+	nativeWriter_t w;
+	uint8_t *rgb = NULL, *pcm = NULL, *out = NULL;
+	uint64_t rgbSize = 0, pcmSize = 0, outSize = 0;
+	uint64_t blocks, block = 0;
+	uint64_t schemeFrames[NUM_OF_COLORSCHEMES];
+	double audioOffset = 0;
+	double blockPeriod = (double)AUDIO_SAMPLES / U64_AUDIO_FREQUENCY;
+	int threads = SDL_GetCPUCount();
+	int started = 0;
+	int writeError = 0;
+	int lastScheme = -1;
+	int result = EXIT_FAILURE;
+
+	memset(&tc, 0, sizeof(tc));
+	memset(&w, 0, sizeof(w));
+	memset(schemeFrames, 0, sizeof(schemeFrames));
+	tc.badFrame = UINT64_MAX;
+	if(threads > DBG_MAX_THREADS) {
+		threads = DBG_MAX_THREADS;
+	}
+
+	// The longest name it uses, when that fits the others do too
+	if(extName(data, name, ".u64.idx") != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	extName(data, name, ".rgb");
+	rgb = mapFile(data->fnbuf, &rgbSize);
+	if(!rgb) {
+		printf("Error: Could not open %s.\n", data->fnbuf);
+		return EXIT_FAILURE;
+	}
+	extName(data, name, ".pcm");
+	pcm = mapFile(data->fnbuf, &pcmSize);
+	blocks = pcm ? pcmSize / SAMPLE_SIZE : 0;
+	// Like playback, recordings without a .sync were PAL with audio starting along with video
+	if(readSyncOffset(data, name, &audioOffset) != EXIT_SUCCESS) {
+		audioOffset = 0;
+	}
+	madvise(rgb, rgbSize, MADV_SEQUENTIAL);
+
+	tc.map = rgb;
+	tc.width = data->width;
+	tc.height = data->height;
+	tc.frameSize = sizeof(uint32_t) * data->width * data->height;
+	tc.frames = rgbSize / tc.frameSize;
+	tc.chunks = (tc.frames + NATIVE_KEYFRAME_INTERVAL - 1) / NATIVE_KEYFRAME_INTERVAL;
+	tc.window = threads * TRANSCODE_SLOTS_PER_THREAD;
+	if(!tc.frames) {
+		printf("Error: %s.rgb holds no whole frame.\n", name);
+		goto clean_up;
+	}
+	transcodeBuildPalettes(data, &tc);
+
+	tc.slots = calloc(tc.window, sizeof(transcodeSlot_t));
+	tc.chunkOffset = malloc(tc.chunks * sizeof(uint64_t));
+	tc.chunkScheme = malloc(tc.chunks);
+	tc.lock = SDL_CreateMutex();
+	tc.cond = SDL_CreateCond();
+	if(!tc.slots || !tc.chunkOffset || !tc.chunkScheme || !tc.lock || !tc.cond) {
+		printf("Error: Out of memory.\n");
+		goto clean_up;
+	}
+	for(int i=0; i < tc.window; i++) {
+		tc.slots[i].chunk = UINT64_MAX;
+		tc.slots[i].coded = malloc((size_t)NATIVE_KEYFRAME_INTERVAL * PACKED_FRAME_SIZE);
+		if(!tc.slots[i].coded) {
+			printf("Error: Out of memory.\n");
+			goto clean_up;
+		}
+	}
+
+	extName(data, name, ".u64");
+	w.fp = fopen(data->fnbuf, "wb");
+	if(!w.fp) {
+		printf("Error opening %s for writing.\n", data->fnbuf);
+		goto clean_up;
+	}
+	data->clock.video.period = PAL_FRAME_PERIOD;
+	writeNativeHeader(&w, data);
+
+	printf("Transcoding %"PRIu64" frames and %"PRIu64" audio blocks from %s.rgb to %s with %i threads...\n",
+		tc.frames, blocks, name, data->fnbuf, threads);
+	uint64_t startTime = SDL_GetPerformanceCounter();
+	for(int t=0; t < threads; t++) {
+		memset(&work[t], 0, sizeof(transcodeWork_t));
+		work[t].tc = &tc;
+		thr[t] = SDL_CreateThread(transcodeWorker, "transcode", &work[t]);
+		if(!thr[t]) {
+			break;
+		}
+		started++;
+	}
+	if(!started) {
+		printf("Error: Could not start any transcoding threads.\n");
+		goto clean_up;
+	}
+
+	for(uint64_t k=0; k < tc.chunks; k++) {
+		transcodeSlot_t *s = &tc.slots[k % tc.window];
+
+		SDL_LockMutex(tc.lock);
+		while(!tc.failed && s->chunk != k) {
+			SDL_CondWait(tc.cond, tc.lock);
+		}
+		SDL_UnlockMutex(tc.lock);
+		if(s->chunk != k) {
+			break;
+		}
+
+		const uint8_t *coded = s->coded;
+		for(uint32_t i=0; i < s->frames && !writeError; i++) {
+			uint64_t f = k * NATIVE_KEYFRAME_INTERVAL + i;
+			double time = f * PAL_FRAME_PERIOD;
+			while(block < blocks && audioOffset + block * blockPeriod <= time) {
+				if(!writeNativeAudio(&w, pcm + block * SAMPLE_SIZE, block, audioOffset + block * blockPeriod)) {
+					writeError = 1;
 				}
-				SDL_UnlockTexture(data->tex);
-				SDL_RenderCopy(data->ren, data->tex, NULL, NULL);
-				SDL_RenderPresent(data->ren);
-				if( SDL_LockTexture(data->tex, NULL, (void**)data->pixels, &data->pitch) ) {
-					printf("Error: Failed to lock texture for writing.");
+				block++;
+			}
+			if(!i) {
+				tc.chunkOffset[k] = ftello(w.fp);
+				tc.chunkScheme[k] = s->scheme[0];
+			}
+			if(s->scheme[i] != lastScheme) {
+				lastScheme = s->scheme[i];
+				if(!writeNativeChunk(w.fp, NATIVE_PALETTE, f, time, tc.palette[lastScheme], sizeof(tc.palette[lastScheme]))) {
+					writeError = 1;
 				}
-			} else {
-				SDL_RenderPresent(data->ren);
 			}
+			if(!writeNativeChunk(w.fp, s->type[i], f, time, coded, s->size[i])) {
+				writeError = 1;
+			}
+			schemeFrames[lastScheme]++;
+			coded += s->size[i];
+			w.bytes += s->size[i];
+			w.frames++;
+			w.repeats += (s->type[i] == NATIVE_VIDEO_REPEAT);
 		}
-		SDLNet_CheckSockets(data->set, SDLNET_STREAM_TIMEOUT);
-	}
 
-	if(strlen(data->hostName) && data->stopStreamOnExit) {
-		runCommand(data, CMD_STOP_STREAM);
+		SDL_LockMutex(tc.lock);
+		s->chunk = UINT64_MAX;
+		tc.written = k + 1;
+		if(writeError) {
+			tc.failed = 1;
+		}
+		SDL_CondBroadcast(tc.cond);
+		SDL_UnlockMutex(tc.lock);
+		if(writeError) {
+			break;
+		}
+	}
+	for(int t=0; t < started; t++) {
+		SDL_WaitThread(thr[t], NULL);
 	}
+	double seconds = (double)(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
 
-	SDL_DestroyTexture(data->tex);
-	if(data->audioFlag) {
-		SDL_CloseAudioDevice(data->dev);
+	if(tc.badFrame != UINT64_MAX) {
+		printf("Error: Frame %"PRIu64" of %s.rgb has colors from none of the palettes, it can't be transcoded without loss.\n", tc.badFrame, name);
+		goto clean_up;
+	}
+	while(!writeError && block < blocks) {
+		if(!writeNativeAudio(&w, pcm + block * SAMPLE_SIZE, block, audioOffset + block * blockPeriod)) {
+			writeError = 1;
+		}
+		block++;
+	}
+	writeNativeHeader(&w, data);
+	if(writeError || tc.failed || fclose(w.fp) != 0) {
+		printf("Error writing %s.u64.\n", name);
+		goto clean_up;
 	}
+	w.fp = NULL;
+	// An index built for an earlier file of the same name would point into the wrong places
+	extName(data, name, ".u64.idx");
+	remove(data->fnbuf);
 
-	// The logic being that if opening either went south, we already exited.
-	if(data->vfp) {
-		fclose(data->vfp);
-		fclose(data->afp);
+	double mb = (double)tc.frames * tc.frameSize / 1e6;
+	double busy = 0;
+	printf("Transcoded in %.1f s, %.1f MB/s of .rgb, %.0f fps (%.0fx realtime).\n", seconds, mb / seconds, tc.frames / seconds, tc.frames / seconds / 50);
+	printf("  Frames: %"PRIu64" bytes, %.1fx smaller than .rgb, %"PRIu64" repeats. Palettes: %"PRIu64" standard, %"PRIu64" DusteD, %"PRIu64" user frames.\n",
+		w.bytes, (double)tc.frames * tc.frameSize / w.bytes, w.repeats, schemeFrames[SCOLORS], schemeFrames[DCOLORS], schemeFrames[UCOLORS]);
+	for(int t=0; t < started; t++) {
+		busy += work[t].busy;
+		printf("  Thread %2i: %7"PRIu64" frames, %7.1f MB/s.\n", t, work[t].frames, work[t].busy > 0 ? work[t].frames * tc.frameSize / 1e6 / work[t].busy : 0);
 	}
+	printf("  Per core: %.1f MB/s on average.\n", busy > 0 ? mb / busy : 0);
 
-	if (data->pkg) {
-		SDLNet_FreePacket(data->pkg);
+	extName(data, name, ".u64");
+	out = mapFile(data->fnbuf, &outSize);
+	if(!out) {
+		printf("Error: Could not open %s to verify it.\n", data->fnbuf);
+		goto clean_up;
 	}
+	madvise(out, outSize, MADV_SEQUENTIAL);
+	tc.out = out;
+	tc.outSize = outSize;
 
-	if (data->audpkg) {
-		SDLNet_FreePacket(data->audpkg);
+	startTime = SDL_GetPerformanceCounter();
+	for(int t=0; t < threads; t++) {
+		memset(&work[t], 0, sizeof(transcodeWork_t));
+		work[t].tc = &tc;
+		work[t].first = tc.chunks * t / threads;
+		work[t].last = tc.chunks * (t + 1) / threads;
+		thr[t] = SDL_CreateThread(transcodeVerifyWorker, "verify", &work[t]);
+		if(!thr[t]) {
+			transcodeVerifyWorker(&work[t]);
+		}
 	}
 
-	if (data->set) {
-		SDLNet_FreeSocketSet(data->set);
+	// Audio is cheap to check, so it is done here while the frames are
+	uint64_t pos = sizeof(nativeHeader_t), audioChecked = 0, audioBad = 0;
+	while(pos + sizeof(nativeChunk_t) <= outSize) {
+		nativeChunk_t c;
+		memcpy(&c, out + pos, sizeof(c));
+		pos += sizeof(c);
+		if(c.size > outSize - pos) {
+			break;
+		}
+		if(c.type == NATIVE_AUDIO) {
+			if(c.seq != audioChecked || c.size != SAMPLE_SIZE || audioChecked >= blocks ||
+			   memcmp(out + pos, pcm + audioChecked * SAMPLE_SIZE, SAMPLE_SIZE)) {
+				audioBad++;
+			}
+			audioChecked++;
+		}
+		pos += c.size;
+	}
+	for(int t=0; t < threads; t++) {
+		if(thr[t]) {
+			SDL_WaitThread(thr[t], NULL);
+		}
 	}
+	seconds = (double)(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
 
-	if (data->udpsock) {
-		SDLNet_UDP_Close(data->udpsock);
+	uint64_t mismatches = SDL_AtomicGet(&tc.mismatches);
+	if(mismatches || audioBad || audioChecked != blocks) {
+		printf("Error: Verifying %s.u64 failed, %"PRIu64" frames and %"PRIu64" of %"PRIu64" audio blocks did not match.\n",
+			name, mismatches, audioBad + (audioChecked > blocks ? audioChecked - blocks : blocks - audioChecked), blocks);
+		goto clean_up;
 	}
+	printf("Verified: all %"PRIu64" frames decode to the pixels of %s.rgb and all %"PRIu64" audio blocks match %s.pcm, in %.1f s (%.1f MB/s).\n",
+		tc.frames, name, blocks, name, seconds, mb / seconds);
+	result = EXIT_SUCCESS;
 
-	if (data->audiosock) {
-		SDLNet_UDP_Close(data->audiosock);
+clean_up:
+	// Only still open when writing it failed, don't leave half a recording behind
+	if(w.fp) {
+		fclose(w.fp);
+		extName(data, name, ".u64");
+		remove(data->fnbuf);
+	}
+	if(tc.slots) {
+		for(int i=0; i < tc.window; i++) {
+			free(tc.slots[i].coded);
+		}
+	}
+	free(tc.slots);
+	free(tc.chunkOffset);
+	free(tc.chunkScheme);
+	if(tc.lock) {
+		SDL_DestroyMutex(tc.lock);
+	}
+	if(tc.cond) {
+		SDL_DestroyCond(tc.cond);
+	}
+	munmap(rgb, rgbSize);
+	if(pcm) {
+		munmap(pcm, pcmSize);
+	}
+	if(out) {
+		munmap(out, outSize);
 	}
 
-	SDL_DestroyRenderer(data->ren);
-	SDL_DestroyWindow(data->win);
-	SDLNet_Quit();
-	SDL_Quit();
+	return result;
+#endif
 }
 
 int main(int argc, char** argv)
@@ -976,17 +8019,65 @@ int main(int argc, char** argv)
 		return EXIT_FAILURE;
 	}
 
+	if(data.benchResampler) {
+		return resamplerBench();
+	}
+
+	if(strlen(data.exportName)) {
+		return exportRecording(&data);
+	}
+
+	if(strlen(data.codecBenchName)) {
+		return codecBench(&data);
+	}
+
+	if(strlen(data.transcodeName)) {
+		return transcodeRecording(&data);
+	}
+
+	if(strlen(data.dbgQuery)) {
+		if(!strlen(data.dbgFile)) {
+			printf("Error: -Q needs a debug capture given with -d.\n");
+			return EXIT_FAILURE;
+		}
+		return queryDebugCapture(&data);
+	}
+
+	if(data.headless) {
+		if(strlen(data.playName)) {
+			printf("Error: Playing a recording needs the window, -r can't be used with -N.\n");
+			return EXIT_FAILURE;
+		}
+		// Nothing draws, so the packets only need assembling into frames
+		data.fast = 1;
+	}
+
+	if(strlen(data.playName)) {
+		if(openPlayback(&data) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		if(setupStream(&data) == EXIT_FAILURE) {
+			closePlayback(&data.play);
+			return EXIT_FAILURE;
+		}
+		runPlayback(&data);
+		return EXIT_SUCCESS;
+	}
+
 	printf("Ultimate64 telnet/command interface at %s\n", data.hostName);
 
 	if (setupStream(&data) == EXIT_FAILURE) {
 		return EXIT_FAILURE;
 	}
 
-	printf("\nRunning...\nPress ESC or close window to stop.\n\n");
+	printf("\nRunning...\n%s\n\n", data.headless ? "Press Ctrl+C to stop." : "Press ESC or close window to stop.");
 	runStream(&data);
 
 	if(data.verbose) {
 		printf("\nReceived video data: %"PRIu64" bytes.\nReceived audio data: %"PRIu64" bytes.\n", data.totalVdataBytes, data.totalAdataBytes);
+		if(data.audioFlag) {
+			printAudioStats(&data);
+		}
 	}
 
 	printf("\n\nThanks to Jens Blidon and Markus Schneider for making my favourite tunes!\nThanks to Booze for making the best remix of Chicanes Halcyon and such beautiful visuals to go along with it!\nThanks to Gideons Logic for the U64!\n\n                                    - DusteD says hi! :-)\n\n");